@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+'''Serves a directory of model archives over HTTP with Range requests, to test
+model downloads against. Add `http://localhost:PORT/models.json` as a
+repository in translateLocally, with the urls in that file pointing at this
+server as well.
+
+--rate slows every response down, and --drop-after cuts connections off after
+sending that many bytes, to see whether interrupted downloads resume.
+'''
+import argparse
+import hashlib
+import os
+import re
+import time
+from functools import partial
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+
+class RangeRequestHandler(SimpleHTTPRequestHandler):
+    """SimpleHTTPRequestHandler plus single Range requests, If-Range, ETag with
+    If-None-Match, and the misbehaviour from the command line arguments.
+    """
+    def __init__(self, *args, rate=None, drop_after=None, **kwargs):
+        self.rate = rate
+        self.drop_after = drop_after
+        super().__init__(*args, **kwargs)
+
+    def etag(self, path):
+        stat = os.stat(path)
+        return '"{}"'.format(hashlib.sha1(f'{stat.st_mtime_ns}-{stat.st_size}'.encode()).hexdigest())
+
+    def send_head(self):
+        self.remaining = None
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            return super().send_head()
+
+        size = os.path.getsize(path)
+        etag = self.etag(path)
+
+        if self.headers.get('If-None-Match') == etag:
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.end_headers()
+            return None
+        start, end = 0, size - 1
+        partial_content = False
+
+        match = re.fullmatch(r'bytes=(\d*)-(\d*)', self.headers.get('Range', ''))
+        if match and self.headers.get('If-Range', etag) == etag:
+            if match.group(1):
+                start = int(match.group(1))
+                end = int(match.group(2)) if match.group(2) else size - 1
+            else: # bytes=-N, the last N bytes
+                start = max(0, size - int(match.group(2)))
+            if start >= size or start > end:
+                self.send_error(416)
+                return None
+            end = min(end, size - 1)
+            partial_content = True
+
+        fh = open(path, 'rb')
+        fh.seek(start)
+        self.send_response(206 if partial_content else 200)
+        self.send_header('Content-Type', self.guess_type(path))
+        self.send_header('Content-Length', str(end - start + 1))
+        self.send_header('Accept-Ranges', 'bytes')
+        self.send_header('ETag', etag)
+        if partial_content:
+            self.send_header('Content-Range', f'bytes {start}-{end}/{size}')
+        self.end_headers()
+        self.remaining = end - start + 1
+        return fh
+
+    def copyfile(self, source, outputfile):
+        if self.remaining is None: # Directory listings and the like
+            return super().copyfile(source, outputfile)
+        sent = 0
+        while self.remaining > 0:
+            chunk = source.read(min(64 * 1024, self.remaining))
+            if not chunk:
+                break
+            if self.drop_after is not None and sent + len(chunk) > self.drop_after:
+                outputfile.write(chunk[:self.drop_after - sent])
+                self.close_connection = True
+                return
+            outputfile.write(chunk)
+            sent += len(chunk)
+            self.remaining -= len(chunk)
+            if self.rate:
+                time.sleep(len(chunk) / self.rate)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('directory', nargs='?', default=os.getcwd())
+    parser.add_argument('--port', type=int, default=8000)
+    parser.add_argument('--rate', type=int, help='bytes per second per connection')
+    parser.add_argument('--drop-after', type=int, help='bytes after which a connection is cut off')
+    args = parser.parse_args()
+
+    handler = partial(RangeRequestHandler, directory=args.directory, rate=args.rate, drop_after=args.drop_after)
+    with ThreadingHTTPServer(('localhost', args.port), handler) as server:
+        print(f'Serving {args.directory} on http://localhost:{args.port}/')
+        server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
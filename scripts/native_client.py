@@ -114,9 +114,40 @@ class TranslateLocally(Client):
         result = await self.request("Translate", {**spec, "text": str(text), "html": bool(html)})
         return result["target"]["text"]
 
+    async def translate_batch(self, texts, src=None, trg=None, *, model=None, pivot=None, html=False):
+        if src and trg:
+            if model or pivot:
+                raise InvalidArgumentException("Cannot combine src + trg and model + pivot arguments")
+            spec = {"src": str(src), "trg": str(trg)}
+        elif model:
+            if pivot:
+                spec = {"model": str(model), "pivot": str(pivot)}
+            else:
+                spec = {"model": str(model)}
+        else:
+            raise InvalidArgumentException("Missing src + trg or model argument")
+
+        items = [{"text": str(text), "html": bool(html)} for text in texts]
+        result = await self.request("TranslateBatch", {**spec, "texts": items})
+        return [item["target"]["text"] for item in result]
+
     async def download_model(self, model_id, *, update=lambda data: None):
         return await self.request("DownloadModel", {"modelID": str(model_id)}, update=update)
 
+    async def load_model(self, model_id, *, pivot=None, update=lambda data: None):
+        spec = {"model": str(model_id)}
+        if pivot:
+            spec["pivot"] = str(pivot)
+        result = await self.request("LoadModel", spec, update=update)
+        return result["models"]
+
+    async def unload_model(self, model_id, *, pivot=None):
+        spec = {"model": str(model_id)}
+        if pivot:
+            spec["pivot"] = str(pivot)
+        result = await self.request("UnloadModel", spec)
+        return result["unloaded"]
+
 
 def first(iterable, *default):
     """Returns the first value of anything iterable, or throws StopIteration
@@ -207,6 +238,14 @@ async def test():
 
         pprint(translations)
 
+        # Same texts in a single batch message
+        batch = await tl.translate_batch([
+            "Hello world!",
+            "Let's translate another sentence to German.",
+        ], "en", "de")
+
+        assert batch == ["Hallo Welt!", "Übersetzen wir einen weiteren Satz mit Deutsch."]
+
         assert translations == [
             "Hallo Welt!",
             "Übersetzen wir einen weiteren Satz mit Deutsch.",
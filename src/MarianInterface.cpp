@@ -2,7 +2,6 @@
 #include "3rd_party/bergamot-translator/src/translator/service.h"
 #include "3rd_party/bergamot-translator/src/translator/parser.h"
 #include "3rd_party/bergamot-translator/src/translator/response.h"
-#include <future>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -10,17 +9,20 @@
 
 namespace  {
 
-std::shared_ptr<marian::Options> makeOptions(const std::string &path_to_model_dir, const translateLocally::marianSettings &settings) {
+// Alignments cost attention extraction during decoding and a matrix per
+// sentence in memory, so models only compute them when asked to. HTML
+// translation needs them too, to put the markup back in place.
+std::shared_ptr<marian::Options> makeOptions(const std::string &path_to_model_dir, const translateLocally::marianSettings &settings, bool alignment) {
     std::shared_ptr<marian::Options> options(marian::bergamot::parseOptionsFromFilePath(path_to_model_dir + "/config.intgemm8bitalpha.yml"));
     options->set("cpu-threads", settings.cpu_threads,
                  "workspace", settings.workspace,
                  "mini-batch-words", 1000,
-                 "alignment", "soft",
+                 "alignment", alignment ? "soft" : "",
                  "quiet", true);
     return options;
 }
 
-int countWords(std::string input) {
+int countWords(std::string const &input) {
     const char * str = input.c_str();
 
     bool inSpaces = true;
@@ -48,6 +50,8 @@ struct TranslationInput {
 struct ModelDescription {
     std::string config_file;
     translateLocally::marianSettings settings;
+    bool alignment;
+    std::string pivot_config_file; // Empty if not pivoting
 };
 
 MarianInterface::MarianInterface(QObject *parent)
@@ -71,6 +75,8 @@ MarianInterface::MarianInterface(QObject *parent)
     worker_ = std::thread([&]() {
         std::unique_ptr<marian::bergamot::AsyncService> service;
         std::shared_ptr<marian::bergamot::TranslationModel> model;
+        std::shared_ptr<marian::bergamot::TranslationModel> pivot; // Translates the output of model, if set
+        bool alignment = false; // Whether model was loaded with alignments enabled
 
         std::mutex internal_mutex;
 
@@ -118,28 +124,46 @@ MarianInterface::MarianInterface(QObject *parent)
                     // Initialise a new model. Old model will be released if
                     // service is done with it, which it is since all translation
                     // requests are effectively blocking in this thread.
-                    auto modelConfig = makeOptions(modelChange->config_file, modelChange->settings);
+                    auto modelConfig = makeOptions(modelChange->config_file, modelChange->settings, modelChange->alignment);
                     model = std::make_shared<marian::bergamot::TranslationModel>(modelConfig, modelChange->settings.cpu_threads);
+                    alignment = modelChange->alignment;
+
+                    pivot.reset();
+                    if (!modelChange->pivot_config_file.empty()) {
+                        auto pivotConfig = makeOptions(modelChange->pivot_config_file, modelChange->settings, modelChange->alignment);
+                        pivot = std::make_shared<marian::bergamot::TranslationModel>(pivotConfig, modelChange->settings.cpu_threads);
+                    }
                 } else if (input) {
                     if (model) {
-                        std::future<int> wordCount = std::async(countWords, input->text); // @TODO we're doing an "unnecessary" string copy here (necessary because we std::move input into service->translate)
+                        // Count before we std::move the input into service->translate. A
+                        // single pass over the text is cheaper than copying it to count
+                        // on another thread.
+                        int wordCount = countWords(input->text);
 
                         Translation translation;
 
+                        // Only ask for alignments if the model computes them.
+                        input->options.alignment = alignment;
+
                         // Measure the time it takes to queue and respond to the
                         // translation request
                         auto start = std::chrono::steady_clock::now(); // Time the translation
-                        service->translate(model, std::move(input->text), [&] (auto &&val) {
+                        auto callback = [&] (auto &&val) {
                             auto end = std::chrono::steady_clock::now();
                             // Calculate translation speed in terms of words per second
-                            double words = wordCount.get();
+                            double words = wordCount;
                             std::chrono::duration<double> elapsedSeconds = end - start;
                             int translationSpeed = std::ceil(words / elapsedSeconds.count());
                             
                             std::unique_lock<std::mutex> lock(internal_mutex);
                             translation = Translation(std::move(val), translationSpeed);
                             cv_.notify_one();
-                        }, input->options);
+                        };
+
+                        if (pivot)
+                            service->pivot(model, pivot, std::move(input->text), callback, input->options);
+                        else
+                            service->translate(model, std::move(input->text), callback, input->options);
                         
                         
                         // Wait for either translate lambda to call back, or a reason to cancel
@@ -169,7 +193,7 @@ QString const &MarianInterface::model() const {
     return model_;
 }
 
-void MarianInterface::setModel(QString path_to_model_dir, const translateLocally::marianSettings &settings) {
+void MarianInterface::setModel(QString path_to_model_dir, const translateLocally::marianSettings &settings, bool alignment, QString path_to_pivot_dir) {
     model_ = path_to_model_dir;
 
     // Empty model string means just "unload" the model. We don't do that (yet),
@@ -179,22 +203,21 @@ void MarianInterface::setModel(QString path_to_model_dir, const translateLocally
 
     // move my shared_ptr from stack to heap
     std::unique_lock<std::mutex> lock(mutex_);
-    std::unique_ptr<ModelDescription> model(new ModelDescription{model_.toStdString(), settings});
+    std::unique_ptr<ModelDescription> model(new ModelDescription{model_.toStdString(), settings, alignment, path_to_pivot_dir.toStdString()});
     std::swap(pendingModel_, model);
 
     // notify worker if there wasn't already a pending model
     cv_.notify_one();
 }
 
-void MarianInterface::translate(QString in, bool HTML) {
+void MarianInterface::translate(Utf8String in, bool HTML) {
     // If we don't have a model yet (loaded, or queued to be loaded, doesn't matter)
     // then don't bother trying to translate something.
     if (model_.isEmpty())
         return;
 
     std::unique_lock<std::mutex> lock(mutex_);
-    std::unique_ptr<TranslationInput> input(new TranslationInput{in.toStdString(), marian::bergamot::ResponseOptions{}});
-    input->options.alignment = true;
+    std::unique_ptr<TranslationInput> input(new TranslationInput{in.release(), marian::bergamot::ResponseOptions{}});
     input->options.HTML = HTML;
 
     std::swap(pendingInput_, input);
@@ -5,6 +5,7 @@
 #include <QObject>
 #include "types.h"
 #include "Translation.h"
+#include "Utf8String.h"
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -31,8 +32,14 @@ public:
     MarianInterface(QObject * parent);
     ~MarianInterface();
     QString const &model() const;
-    void setModel(QString path_to_model_dir, const translateLocally::marianSettings& settings);
-    void translate(QString in, bool HTML=false);
+    /**
+     * @brief loads a model. With `alignment` the model also computes word
+     * alignments for its translations, which takes extra time and memory.
+     * Translating HTML needs them. With a `path_to_pivot_dir`, translations go through that model after
+     * the first one, e.g. for a ModelRoute.
+     */
+    void setModel(QString path_to_model_dir, const translateLocally::marianSettings& settings, bool alignment, QString path_to_pivot_dir = QString());
+    void translate(Utf8String in, bool HTML=false);
 signals:
     void translationReady(Translation translation);
     void pendingChanged(bool isBusy); // Disables issuing another translation while we are busy.
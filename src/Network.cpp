@@ -3,6 +3,7 @@
 #include <QTemporaryFile>
 #include <QSharedPointer>
 #include <QCoreApplication>
+#include <QTimer>
 
 Network::Network(QObject *parent)
     : QObject(parent)
@@ -98,3 +99,27 @@ QNetworkReply* Network::downloadFile(QUrl url, QCryptographicHash::Algorithm alg
 
     return reply;
 }
+
+SegmentedDownload* Network::downloadStream(QUrl url, QIODevice *dest, QString partialPath, QCryptographicHash::Algorithm algorithm, QByteArray hash, QVariant extradata) {
+    if (!dest->open(QIODevice::WriteOnly)) {
+        emit error(tr("Cannot start processing the download: %1").arg(dest->errorString()), extradata);
+        return nullptr;
+    }
+
+    SegmentedDownload *download = new SegmentedDownload(this, url, partialPath, dest, algorithm, hash, this);
+
+    connect(download, &SegmentedDownload::downloadProgress, this, &Network::progressBar);
+
+    connect(download, &SegmentedDownload::completed, this, [=](QIODevice *device, QString filename) {
+        emit streamComplete(device, filename, extradata);
+    });
+
+    connect(download, &SegmentedDownload::failed, this, [=](QString message) {
+        emit error(message, extradata);
+    });
+
+    // Start once the caller had the chance to connect to the download.
+    QTimer::singleShot(0, download, &SegmentedDownload::start);
+
+    return download;
+}
@@ -4,6 +4,7 @@
 #include <QNetworkAccessManager>
 #include <QCryptographicHash>
 #include <memory>
+#include "SegmentedDownload.h"
 
 class QFile;
 
@@ -33,12 +34,25 @@ public:
      * the file's parent.
      */
     QNetworkReply *downloadFile(QUrl url, QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256, QByteArray hash = QByteArray(), QVariant extradata = QVariant());
+
+    /**
+     * Download into a device that consumes the data as it comes in, e.g. an
+     * ArchiveExtractor. The download is split over several HTTP Range requests
+     * that are written to `partialPath` as they come in, and from there
+     * passed on to `dest` in order. If it is interrupted, downloading the same
+     * url to the same `partialPath` picks up where it left off. See
+     * SegmentedDownload. When all of it is written, `dest` is closed, and if
+     * the hash matches the `streamComplete(QIODevice*,QString)` signal is
+     * emitted.
+     */
+    SegmentedDownload *downloadStream(QUrl url, QIODevice *dest, QString partialPath, QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256, QByteArray hash = QByteArray(), QVariant extradata = QVariant());
     
 private:
     std::unique_ptr<QNetworkAccessManager> nam_;
 
 signals:
     void downloadComplete(QFile* file, QString filename, QVariant extradata = QVariant());
+    void streamComplete(QIODevice* dest, QString filename, QVariant extradata = QVariant());
     void progressBar(qint64 ist, qint64 max);
     void error(QString err, QVariant extradata = QVariant());
 };
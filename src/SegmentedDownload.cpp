@@ -0,0 +1,515 @@
+#include "SegmentedDownload.h"
+#include "Network.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QSaveFile>
+#include <QTimer>
+#include <algorithm>
+
+namespace {
+
+// Bump when the layout of the state file changes. Older ones are ignored.
+const int kStateVersion = 1;
+
+// Files are split in at most this many parts, each at least kMinSegmentSize.
+const qint64 kMaxSegments = 4;
+const qint64 kMinSegmentSize = 8 * 1024 * 1024;
+
+// A part that keeps failing without receiving anything in between is given up
+// on after kMaxRetries, waiting a little longer before each attempt.
+const int kMaxRetries = 5;
+const int kRetryDelay = 1000; // ms
+
+// How much of the file dest may have waiting, and how much to read from disk
+// at once to pass on.
+const qint64 kMaxFeedBacklog = 4 * 1024 * 1024;
+const qint64 kFeedChunk = 1024 * 1024;
+
+// Received bytes after which the state is saved, so that a crash doesn't
+// lose more than this per part.
+const qint64 kStateInterval = 8 * 1024 * 1024;
+
+int statusCode(QNetworkReply *reply) {
+    return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+}
+
+} // Anonymous namespace
+
+qint64 SegmentedDownload::Segment::size() const {
+    return end - start;
+}
+
+bool SegmentedDownload::Segment::isComplete() const {
+    return end >= 0 && received >= size();
+}
+
+SegmentedDownload::SegmentedDownload(Network *network, QUrl url, QString partialPath, QIODevice *dest, QCryptographicHash::Algorithm algorithm, QByteArray hash, QObject *parent)
+: QObject(parent)
+, network_(network)
+, url_(std::move(url))
+, partialPath_(QFileInfo(partialPath).absoluteFilePath())
+, partial_(partialPath_)
+, lock_(partialPath_ + ".lock")
+, dest_(dest)
+, hasher_(algorithm)
+, hash_(std::move(hash))
+, resumable_(false)
+, validated_(true)
+, stopped_(false)
+, fed_(0)
+, unsaved_(0) {
+    //
+}
+
+SegmentedDownload::~SegmentedDownload() {
+    if (!stopped_) {
+        stop();
+        saveState();
+    }
+}
+
+QUrl SegmentedDownload::url() const {
+    return url_;
+}
+
+void SegmentedDownload::start() {
+    QDir().mkpath(QFileInfo(partialPath_).absolutePath());
+
+    // Two downloads writing to the same partial file would make a mess of it,
+    // also when they are in different processes, e.g. the GUI and a native
+    // messaging host. A lock left behind by a process that is gone is taken
+    // over, but never one that is merely old: downloads can take a while.
+    lock_.setStaleLockTime(0);
+    if (!lock_.tryLock()) {
+        stopped_ = true;
+        emit failed(tr("%1 is already being downloaded.").arg(url_.toString()));
+        finish();
+        return;
+    }
+
+    bool resumed = loadState();
+
+    if (!partial_.open(resumed ? QIODevice::ReadWrite : QIODevice::ReadWrite | QIODevice::Truncate)) {
+        fail(tr("Cannot open file for downloading: %1").arg(partial_.errorString()), false);
+        return;
+    }
+
+    connect(dest_, &QIODevice::bytesWritten, this, &SegmentedDownload::feed);
+
+    if (!resumed) {
+        probe();
+        return;
+    }
+
+    // Don't pass on anything from disk before the server confirmed that it is
+    // still serving the same file. If nothing is missing, the hash will tell.
+    validated_ = true;
+    for (int i = 0; i < segments_.size(); ++i) {
+        if (!segments_[i].isComplete()) {
+            validated_ = validator_.isEmpty();
+            request(i);
+        }
+    }
+
+    feed();
+}
+
+void SegmentedDownload::abort() {
+    if (stopped_)
+        return;
+
+    stop();
+    saveState();
+    finish();
+}
+
+void SegmentedDownload::probe() {
+    QNetworkRequest request(url_);
+    request.setRawHeader("Range", "bytes=0-");
+    QNetworkReply *reply = network_->get(request);
+
+    segments_ = {Segment{0, -1, 0, 0, reply}};
+
+    // Once we know what the server thinks of the Range header, we know
+    // whether we can start on the other parts.
+    connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply] {
+        if (segments_.size() != 1 || segments_[0].reply != reply || segments_[0].end >= 0)
+            return;
+
+        int status = statusCode(reply);
+
+        if (status == 206) {
+            // Content-Range: bytes 0-1023/4096
+            QByteArray range = reply->rawHeader("Content-Range");
+            bool ok;
+            qint64 size = range.mid(range.indexOf('/') + 1).toLongLong(&ok);
+            if (ok && size > 0) {
+                QByteArray etag = reply->rawHeader("ETag");
+                validator_ = etag.startsWith("W/") ? reply->rawHeader("Last-Modified") : etag;
+                resumable_ = true;
+                split(size, reply);
+                return;
+            }
+        }
+
+        // The whole thing in one go, then.
+        if (status >= 200 && status < 300) {
+            QVariant length = reply->header(QNetworkRequest::ContentLengthHeader);
+            if (length.isValid() && length.toLongLong() > 0)
+                segments_[0].end = length.toLongLong();
+        }
+    });
+
+    connect(reply, &QNetworkReply::readyRead, this, [this, reply] { receive(0, reply); });
+    connect(reply, &QNetworkReply::finished, this, [this, reply] { segmentFinished(0, reply); });
+}
+
+void SegmentedDownload::split(qint64 size, QNetworkReply *reply) {
+    qint64 count = qBound(qint64(1), size / kMinSegmentSize, kMaxSegments);
+    qint64 length = (size + count - 1) / count;
+
+    segments_.clear();
+    for (qint64 start = 0; start < size; start += length)
+        segments_.append(Segment{start, qMin(size, start + length), 0, 0, nullptr});
+
+    // The first part is already coming in through the probe. It will be cut
+    // off at the end of the part in receive().
+    segments_[0].reply = reply;
+
+    for (int i = 1; i < segments_.size(); ++i)
+        request(i);
+
+    saveState();
+}
+
+void SegmentedDownload::request(int index) {
+    Segment &segment = segments_[index];
+
+    QNetworkRequest request(url_);
+    request.setRawHeader("Range", QString("bytes=%1-%2").arg(segment.start + segment.received).arg(segment.end - 1).toUtf8());
+
+    // Only give us the part if the file is still the one we've got the other
+    // parts of. Otherwise the server sends all of it.
+    if (!validator_.isEmpty())
+        request.setRawHeader("If-Range", validator_);
+
+    QNetworkReply *reply = network_->get(request);
+    segment.reply = reply;
+
+    connect(reply, &QNetworkReply::metaDataChanged, this, [this, index, reply] {
+        if (segments_[index].reply != reply)
+            return;
+
+        int status = statusCode(reply);
+
+        if (status == 206) {
+            if (!validated_) {
+                validated_ = true;
+                feed();
+            }
+            return;
+        }
+
+        // Errors are dealt with once the reply finishes.
+        if (status < 200 || status >= 300)
+            return;
+
+        // The server sends the whole file: it isn't the one we have parts
+        // of any more. Start over, if we didn't pass any of it on yet.
+        if (fed_ == 0)
+            restart();
+        else
+            fail(tr("%1 changed on the server while it was being downloaded.").arg(url_.toString()), false);
+    });
+
+    connect(reply, &QNetworkReply::readyRead, this, [this, index, reply] { receive(index, reply); });
+    connect(reply, &QNetworkReply::finished, this, [this, index, reply] { segmentFinished(index, reply); });
+}
+
+void SegmentedDownload::restart() {
+    for (Segment &segment : segments_) {
+        if (segment.reply) {
+            disconnect(segment.reply, nullptr, this, nullptr);
+            segment.reply->abort();
+            segment.reply->deleteLater();
+        }
+    }
+
+    segments_.clear();
+    validator_.clear();
+    resumable_ = false;
+    validated_ = true;
+    hasher_.reset();
+    unsaved_ = 0;
+
+    QFile::remove(partialPath_ + ".json");
+    partial_.resize(0);
+
+    probe();
+}
+
+void SegmentedDownload::receive(int index, QNetworkReply *reply) {
+    if (segments_[index].reply != reply)
+        return;
+
+    Segment &segment = segments_[index];
+
+    qint64 available = reply->bytesAvailable();
+    if (segment.end >= 0)
+        available = qMin(available, segment.size() - segment.received);
+
+    if (available > 0) {
+        QByteArray buffer = reply->read(available);
+
+        if (!partial_.seek(segment.start + segment.received) || partial_.write(buffer) != buffer.size()) {
+            fail(tr("An error occurred while writing the downloaded data to disk: %1").arg(partial_.errorString()));
+            return;
+        }
+
+        segment.received += buffer.size();
+        segment.retries = 0;
+        unsaved_ += buffer.size();
+    }
+
+    // The probe asked for everything, but we only want its own part of it.
+    if (segment.isComplete() && !reply->isFinished()) {
+        segment.reply = nullptr;
+        disconnect(reply, nullptr, this, nullptr);
+        reply->abort();
+        reply->deleteLater();
+        saveState();
+    } else if (unsaved_ >= kStateInterval) {
+        saveState();
+    }
+
+    qint64 received = 0;
+    for (Segment const &segment : qAsConst(segments_))
+        received += segment.received;
+    emit downloadProgress(received, segments_.last().end);
+
+    feed();
+}
+
+void SegmentedDownload::segmentFinished(int index, QNetworkReply *reply) {
+    if (stopped_ || segments_[index].reply != reply)
+        return;
+
+    // Whatever is left of it still goes to disk.
+    if (reply->error() == QNetworkReply::NoError) {
+        receive(index, reply);
+        if (stopped_)
+            return;
+    }
+
+    Segment &segment = segments_[index];
+    segment.reply = nullptr;
+    reply->deleteLater();
+
+    if (reply->error() == QNetworkReply::NoError) {
+        // Only now do we know how big a file without Content-Length is.
+        if (segment.end < 0)
+            segment.end = segment.start + segment.received;
+
+        if (segment.isComplete()) {
+            saveState();
+            feed();
+            return;
+        }
+    }
+
+    // Anything else, including the transfer timeout, is worth another try if
+    // we can pick up where we were. A 416 means our parts don't fit the file.
+    int status = statusCode(reply);
+    if (resumable_ && status != 416 && segment.retries < kMaxRetries) {
+        ++segment.retries;
+        saveState();
+        QTimer::singleShot(kRetryDelay * segment.retries, this, [this, index] {
+            if (!stopped_)
+                request(index);
+        });
+        return;
+    }
+
+    QString reason = reply->error() == QNetworkReply::NoError ? tr("The connection closed before all data was received.") : reply->errorString();
+    fail(tr("An error occurred while downloading %1: %2").arg(url_.toString(), reason), resumable_ && status != 416);
+}
+
+qint64 SegmentedDownload::contiguous() const {
+    qint64 end = 0;
+    for (Segment const &segment : segments_) {
+        end = segment.start + segment.received;
+        if (!segment.isComplete())
+            break;
+    }
+    return end;
+}
+
+void SegmentedDownload::feed() {
+    if (stopped_ || !validated_)
+        return;
+
+    qint64 available = contiguous();
+
+    while (fed_ < available && dest_->bytesToWrite() < kMaxFeedBacklog) {
+        QByteArray buffer;
+        if (partial_.seek(fed_))
+            buffer = partial_.read(qMin(kFeedChunk, available - fed_));
+
+        if (buffer.isEmpty()) {
+            fail(tr("An error occurred while reading the downloaded data from disk: %1").arg(partial_.errorString()), false);
+            return;
+        }
+
+        hasher_.addData(buffer);
+
+        if (dest_->write(buffer) != buffer.size()) {
+            fail(tr("An error occurred while processing the downloaded data: %1").arg(dest_->errorString()), false);
+            return;
+        }
+
+        fed_ += buffer.size();
+    }
+
+    bool done = !segments_.isEmpty() && std::all_of(segments_.begin(), segments_.end(), [](Segment const &segment) {
+        return segment.isComplete();
+    });
+
+    if (done && fed_ == available)
+        complete();
+}
+
+bool SegmentedDownload::loadState() {
+    QFile file(partialPath_ + ".json");
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonObject state = QJsonDocument::fromJson(file.readAll()).object();
+    if (state.value("version").toInt() != kStateVersion || state.value("url").toString() != url_.toString())
+        return false;
+
+    // Never trust the state to be ahead of what actually made it to disk.
+    qint64 onDisk = QFileInfo(partialPath_).size();
+
+    QVector<Segment> segments;
+    qint64 expected = 0;
+    for (QJsonValue const &value : state.value("segments").toArray()) {
+        QJsonArray fields = value.toArray();
+        Segment segment{
+            static_cast<qint64>(fields.at(0).toDouble()),
+            static_cast<qint64>(fields.at(1).toDouble()),
+            static_cast<qint64>(fields.at(2).toDouble()),
+            0,
+            nullptr
+        };
+
+        // Parts have to cover the file from start to end without gaps.
+        if (segment.start != expected || segment.end <= segment.start)
+            return false;
+
+        segment.received = qBound(qint64(0), segment.received, qMin(segment.size(), onDisk - segment.start));
+        segments.append(segment);
+        expected = segment.end;
+    }
+
+    if (segments.isEmpty())
+        return false;
+
+    segments_ = segments;
+    validator_ = state.value("validator").toString().toUtf8();
+    resumable_ = true;
+    return true;
+}
+
+void SegmentedDownload::saveState() {
+    if (!resumable_ || !partial_.isOpen() || segments_.isEmpty())
+        return;
+
+    // What the state says is on disk has to be on disk.
+    partial_.flush();
+
+    QJsonArray segments;
+    for (Segment const &segment : qAsConst(segments_))
+        segments.append(QJsonArray{double(segment.start), double(segment.end), double(segment.received)});
+
+    QJsonObject state{
+        {"version", kStateVersion},
+        {"url", url_.toString()},
+        {"validator", QString::fromUtf8(validator_)},
+        {"segments", segments}
+    };
+
+    QSaveFile file(partialPath_ + ".json");
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Could not write download state" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+
+    file.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+    if (!file.commit())
+        qDebug() << "Could not write download state" << file.fileName() << ":" << file.errorString();
+
+    unsaved_ = 0;
+}
+
+void SegmentedDownload::removeState() {
+    partial_.close();
+    QFile::remove(partialPath_);
+    QFile::remove(partialPath_ + ".json");
+}
+
+void SegmentedDownload::complete() {
+    stopped_ = true;
+
+    // Tell dest that's all. It may still be busy with the last of it.
+    dest_->close();
+
+    // Either we're done with it, or it's corrupt. No need to keep it.
+    removeState();
+
+    if (!hash_.isEmpty() && hasher_.result() != hash_)
+        emit failed(tr("The cryptographic hash of %1 does not match the provided hash.\nExpected: %2\nActual: %3\nFile size: %4").arg(url_.toString(),
+                                                                                                                      QString(hash_.toHex()),
+                                                                                                                      QString(hasher_.result().toHex()),
+                                                                                                                      QString::number(fed_)));
+    else
+        emit completed(dest_, url_.fileName());
+
+    finish();
+}
+
+void SegmentedDownload::fail(QString message, bool keepPartial) {
+    stop();
+
+    if (keepPartial)
+        saveState();
+    else
+        removeState();
+
+    emit failed(message);
+    finish();
+}
+
+void SegmentedDownload::stop() {
+    stopped_ = true;
+
+    for (Segment &segment : segments_) {
+        if (segment.reply) {
+            disconnect(segment.reply, nullptr, this, nullptr);
+            segment.reply->abort();
+            segment.reply->deleteLater();
+            segment.reply = nullptr;
+        }
+    }
+}
+
+void SegmentedDownload::finish() {
+    lock_.unlock();
+
+    emit finished();
+    deleteLater();
+}
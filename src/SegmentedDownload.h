@@ -0,0 +1,154 @@
+#ifndef SEGMENTEDDOWNLOAD_H
+#define SEGMENTEDDOWNLOAD_H
+#include <QObject>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QLockFile>
+#include <QUrl>
+#include <QVector>
+
+class Network;
+class QNetworkReply;
+
+/**
+ * Download that fetches a file in several parts at the same time using HTTP
+ * Range requests, and that picks up where it left off if it is interrupted,
+ * even by quitting the application. Created by Network::downloadStream().
+ *
+ * The parts are written to a file at `partialPath`, next to which the state
+ * of every part is kept in `partialPath.json`, and which is locked through
+ * `partialPath.lock` while a download, in any process, writes to it. Whatever is there from the
+ * start of the file onward is passed on to `dest`, in order, as soon as it is
+ * on disk, and hashed on the way. That is also how a resumed download
+ * catches up: first from disk, then from the network.
+ *
+ * Servers that don't do Range requests get a single plain download, which
+ * can't be resumed. The partial file is removed once the download completes
+ * or turns out to be corrupt. If it is aborted or fails it is kept, so the
+ * next download of the same file to the same path can continue it.
+ */
+class SegmentedDownload : public QObject {
+    Q_OBJECT
+
+public:
+    SegmentedDownload(Network *network, QUrl url, QString partialPath, QIODevice *dest, QCryptographicHash::Algorithm algorithm, QByteArray hash, QObject *parent = nullptr);
+    ~SegmentedDownload();
+
+    /**
+     * @brief opens the partial file and starts or resumes fetching. Emits
+     * failed() if that doesn't work out.
+     */
+    void start();
+
+    QUrl url() const;
+
+public slots:
+    /**
+     * @brief stops the download, keeping what was downloaded for next time.
+     * Emits finished() but not failed().
+     */
+    void abort();
+
+private:
+    struct Segment {
+        qint64 start; // Offset in the file
+        qint64 end; // Offset just past the segment, -1 while the size isn't known
+        qint64 received; // Bytes from start that are on disk
+        int retries;
+        QNetworkReply *reply;
+
+        qint64 size() const;
+        bool isComplete() const;
+    };
+
+    /**
+     * @brief requests what is missing of a segment from the server.
+     */
+    void request(int index);
+
+    /**
+     * @brief the first request, which is for the whole file. If the server
+     * answers with part of it, the file is split over multiple segments.
+     */
+    void probe();
+
+    /**
+     * @brief divides the file of `size` bytes into segments, the first of
+     * which is already being fetched by `reply`.
+     */
+    void split(qint64 size, QNetworkReply *reply);
+
+    /**
+     * @brief writes what `reply` has for a segment to the partial file.
+     */
+    void receive(int index, QNetworkReply *reply);
+    void segmentFinished(int index, QNetworkReply *reply);
+
+    /**
+     * @brief throws away everything we have, and starts over.
+     */
+    void restart();
+
+    /**
+     * @brief passes what's on disk from where dest left off on to dest, as
+     * far as that is available in one piece. Completes the download once dest
+     * got everything.
+     */
+    void feed();
+
+    /**
+     * @brief Bytes available from the start of the file without gaps.
+     */
+    qint64 contiguous() const;
+
+    bool loadState();
+    void saveState();
+    void removeState();
+
+    void complete();
+    void fail(QString message, bool keepPartial = true);
+
+    /**
+     * @brief aborts all requests.
+     */
+    void stop();
+
+    /**
+     * @brief emits finished() and cleans up after itself.
+     */
+    void finish();
+
+    Network *network_;
+    QUrl url_;
+    QString partialPath_;
+    QFile partial_;
+    QLockFile lock_; // At `partialPath.lock`, held while we write to partial_
+    QIODevice *dest_;
+    QCryptographicHash hasher_;
+    QByteArray hash_;
+
+    QVector<Segment> segments_;
+    QByteArray validator_; // ETag or Last-Modified of the file we have parts of
+    bool resumable_; // Server does Range requests
+    bool validated_; // Server confirmed what is on disk still matches
+    bool stopped_;
+    qint64 fed_; // Bytes passed on to dest_
+    qint64 unsaved_; // Bytes received since the state was last saved
+
+signals:
+    void downloadProgress(qint64 ist, qint64 max);
+
+    /**
+     * @brief all of it is written to dest, which is closed, and the hash
+     * matches.
+     */
+    void completed(QIODevice *dest, QString filename);
+    void failed(QString message);
+
+    /**
+     * @brief emitted at the end in all cases: completed, failed or aborted.
+     */
+    void finished();
+};
+
+#endif // SEGMENTEDDOWNLOAD_H
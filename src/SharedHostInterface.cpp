@@ -0,0 +1,149 @@
+#include "SharedHostInterface.h"
+#include "cli/NativeMsgIface.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <cmath>
+#include <cstring>
+
+SharedHostInterface *SharedHostInterface::connectTo(QString const &name, QObject *parent) {
+    QLocalSocket *socket = new QLocalSocket();
+    socket->connectToServer(name);
+    if (!socket->waitForConnected(kRelayConnectTimeout)) {
+        delete socket;
+        return nullptr;
+    }
+
+    return new SharedHostInterface(socket, parent);
+}
+
+SharedHostInterface::SharedHostInterface(QLocalSocket *socket, QObject *parent)
+: QObject(parent)
+, socket_(socket)
+, alignment_(false)
+, nextID_(0)
+, pendingID_(-1)
+, pendingWords_(0) {
+    socket_->setParent(this);
+
+    connect(socket_, &QLocalSocket::readyRead, this, &SharedHostInterface::readMessages);
+    connect(socket_, &QLocalSocket::disconnected, this, [this]() {
+        if (pendingID_ != -1) {
+            pendingID_ = -1;
+            emit pendingChanged(false);
+        }
+        emit disconnected();
+    });
+}
+
+QString const &SharedHostInterface::model() const {
+    return model_;
+}
+
+void SharedHostInterface::setModel(Model const &model, bool alignment) {
+    model_ = model.path;
+    modelID_ = model.id();
+    alignment_ = alignment;
+
+    // See MarianInterface::setModel()
+    if (model_.isEmpty())
+        return;
+
+    // So the first translation doesn't have to wait for it. Any trouble
+    // loading it is reported for that translation.
+    send("LoadModel", QJsonObject{
+        {"model", modelID_},
+        {"alignments", alignment_}
+    });
+}
+
+void SharedHostInterface::translate(Utf8String in, bool HTML) {
+    // See MarianInterface::translate()
+    if (model_.isEmpty())
+        return;
+
+    if (pendingID_ != -1)
+        send("Cancel", QJsonObject{{"requestID", pendingID_}});
+    else
+        emit pendingChanged(true);
+
+    pendingID_ = nextID_;
+    pendingWords_ = in.countWords();
+    pendingTimer_.start();
+
+    send("Translate", QJsonObject{
+        {"model", modelID_},
+        {"text", QString::fromStdString(in.release())},
+        {"html", HTML},
+        {"alignments", alignment_}
+    });
+}
+
+void SharedHostInterface::send(QString const &command, QJsonObject &&data) {
+    QJsonObject message{
+        {"id", nextID_++},
+        {"command", command},
+        {"data", std::move(data)}
+    };
+
+    QByteArray json = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    quint32 size = static_cast<quint32>(json.size());
+    socket_->write(reinterpret_cast<char const *>(&size), sizeof(size));
+    socket_->write(json);
+}
+
+void SharedHostInterface::readMessages() {
+    buffer_.append(socket_->readAll());
+
+    // Frames as NativeMsgIface::acceptConnections() writes them: the length
+    // in native byte order, then the message.
+    int offset = 0;
+    for (;;) {
+        quint32 size;
+        if (buffer_.size() - offset < int(sizeof(size)))
+            break;
+
+        std::memcpy(&size, buffer_.constData() + offset, sizeof(size));
+        if (quint32(buffer_.size() - offset) - sizeof(size) < size)
+            break;
+
+        handleMessage(QJsonDocument::fromJson(buffer_.mid(offset + sizeof(size), size)).object());
+        offset += sizeof(size) + size;
+    }
+
+    buffer_.remove(0, offset);
+}
+
+void SharedHostInterface::handleMessage(QJsonObject const &message) {
+    // Answers to LoadModel, Cancel and translations that were cancelled
+    // don't matter anymore.
+    if (pendingID_ == -1 || message.value("id").toInt(-1) != pendingID_ || message.value("update").toBool())
+        return;
+
+    pendingID_ = -1;
+    emit pendingChanged(false);
+
+    if (!message.value("success").toBool()) {
+        emit error(message.value("error").toString());
+        return;
+    }
+
+    QJsonObject target = message.value("data").toObject().value("target").toObject();
+
+    HostTranslation translation;
+    translation.text = target.value("text").toString().toStdString();
+    for (auto &&value : target.value("alignments").toArray()) {
+        QJsonArray pair = value.toArray();
+        translation.alignments.append(HostTranslation::Alignment{
+            pair.at(0).toInt(),
+            pair.at(1).toInt(),
+            pair.at(2).toInt(),
+            pair.at(3).toInt(),
+            static_cast<float>(pair.at(4).toDouble())
+        });
+    }
+
+    // Same as MarianInterface: from asking to having the answer.
+    double seconds = pendingTimer_.elapsed() / 1000.0;
+    int speed = seconds > 0 ? static_cast<int>(std::ceil(pendingWords_ / seconds)) : 0;
+    emit translationReady(Translation(std::move(translation), speed));
+}
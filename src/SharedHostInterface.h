@@ -0,0 +1,84 @@
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QObject>
+#include <QString>
+#include "Translation.h"
+#include "Utf8String.h"
+#include "inventory/ModelManager.h"
+
+/**
+ * Translates through the shared native messaging host (see
+ * NativeMsgIface::listen()) instead of loading models in this process. With
+ * the shared_native_host setting, the GUI uses this if a browser's host
+ * is running when it starts, so the models aren't loaded twice and the two
+ * don't compete for the same cores.
+ *
+ * Same interface as MarianInterface. It talks to the host the way a browser
+ * does, over the socket a NativeMsgRelay would use. As with MarianInterface
+ * only the last translation matters: a new one cancels the one still
+ * pending.
+ */
+class SharedHostInterface : public QObject {
+    Q_OBJECT
+
+public:
+    /**
+     * @brief connects to the host listening on `name`.
+     * @return nullptr if nobody is listening.
+     */
+    static SharedHostInterface *connectTo(QString const &name, QObject *parent = nullptr);
+
+    /**
+     * @brief path of the model, like MarianInterface::model().
+     */
+    QString const &model() const;
+
+    /**
+     * @brief translates with `model` from now on. The host loads it ahead
+     * of the first translation. See MarianInterface::setModel() for
+     * `alignment`.
+     */
+    void setModel(Model const &model, bool alignment);
+
+    void translate(Utf8String in, bool HTML = false);
+
+signals:
+    void translationReady(Translation translation);
+    void pendingChanged(bool isBusy);
+    void error(QString message);
+
+    /**
+     * @brief Emitted when the host went away, e.g. because the browser
+     * closed it. Nothing is translated anymore after that.
+     */
+    void disconnected();
+
+private slots:
+    /**
+     * @brief hooked to the socket's readyRead, handles the answers of the
+     * host.
+     */
+    void readMessages();
+
+private:
+    SharedHostInterface(QLocalSocket *socket, QObject *parent);
+
+    void send(QString const &command, QJsonObject &&data);
+
+    void handleMessage(QJsonObject const &message);
+
+    QLocalSocket *socket_;
+    QString model_;
+    QString modelID_;
+    bool alignment_;
+
+    int nextID_;
+    int pendingID_; // Id of the Translate request we're waiting for, or -1
+    std::size_t pendingWords_;
+    QElapsedTimer pendingTimer_;
+
+    QByteArray buffer_; // Start of a message that isn't complete yet
+};
@@ -67,6 +67,14 @@ marian::bergamot::AnnotatedText const &_target(marian::bergamot::Response const
         return response.source;
 }
 
+// Sort by position (left to right), highest probability first.
+QVector<WordAlignment> &sortAlignments(QVector<WordAlignment> &alignments) {
+    std::sort(alignments.begin(), alignments.end(), [](WordAlignment const &a, WordAlignment const &b) {
+        return a.begin <= b.begin && a.prob > b.prob;
+    });
+    return alignments;
+}
+
 } // Anonymous namespace
 
 Translation::Translation()
@@ -81,20 +89,50 @@ Translation::Translation(marian::bergamot::Response &&response, int speed)
     //
 }
 
+Translation::Translation(HostTranslation &&translation, int speed)
+: response_(nullptr)
+, hostTranslation_(std::make_shared<HostTranslation>(std::move(translation)))
+, speed_(speed) {
+    //
+}
+
+std::string const &Translation::translationUtf8() const {
+    return hostTranslation_ ? hostTranslation_->text : response_->target.text;
+}
+
 QString Translation::translation() const {
-    return QString::fromStdString(response_->target.text);
+    return QString::fromStdString(translationUtf8());
 }
 
 QVector<WordAlignment> Translation::alignments(Direction direction, int sourcePosFirst, int sourcePosLast) const {
     QVector<WordAlignment> alignments;
     std::size_t sentenceIdxFirst, sentenceIdxLast, wordIdxFirst, wordIdxLast;
 
-    if (!response_)
-        return alignments;
-
     if (sourcePosFirst > sourcePosLast)
         std::swap(sourcePosFirst, sourcePosLast);
 
+    // The host already paired up the words, and only sent the likely pairs.
+    if (hostTranslation_) {
+        for (auto &&pair : hostTranslation_->alignments) {
+            bool forward = direction == Translation::source_to_translation;
+            int begin = forward ? pair.sourceBegin : pair.targetBegin;
+            int end = forward ? pair.sourceEnd : pair.targetEnd;
+            if (end < sourcePosFirst || begin > sourcePosLast)
+                continue;
+
+            WordAlignment alignment;
+            alignment.begin = forward ? pair.targetBegin : pair.sourceBegin;
+            alignment.end = forward ? pair.targetEnd : pair.sourceEnd;
+            alignment.prob = pair.prob;
+            alignments.append(alignment);
+        }
+        return sortAlignments(alignments);
+    }
+
+    // Translations made without alignments have none for any sentence.
+    if (!response_ || response_->alignments.empty())
+        return alignments;
+
     std::size_t sourceOffsetFirst = ::positionToOffset(::_source(*response_, direction).text, sourcePosFirst);
     if (!::findWordByByteOffset(::_source(*response_, direction).annotation, sourceOffsetFirst, sentenceIdxFirst, wordIdxFirst))
         return alignments;
@@ -150,10 +188,5 @@ QVector<WordAlignment> Translation::alignments(Direction direction, int sourcePo
         }
     }
 
-    // Sort by position (left to right), highest probability first.
-    std::sort(alignments.begin(), alignments.end(), [](WordAlignment const &a, WordAlignment const &b) {
-        return a.begin <= b.begin && a.prob > b.prob;
-    });
-
-    return alignments;
+    return sortAlignments(alignments);
 }
@@ -3,6 +3,7 @@
 #include <QString>
 #include <QVector>
 #include <memory>
+#include <string>
 
 namespace marian {
     namespace bergamot {
@@ -22,15 +23,35 @@ struct WordAlignment {
 };
 
 /**
- * Wrapper around a translation response from the bergamot service. Hides that
- * interface from the rest of the Qt code, and provides utility functions to
- * access alignment information with character offsets instead of byte offsets.
+ * A translation made by the shared native messaging host, as it comes in
+ * through SharedHostInterface. Offsets are in UTF-16 code units, like the
+ * host sends them.
+ */
+struct HostTranslation {
+    struct Alignment {
+        int targetBegin;
+        int targetEnd;
+        int sourceBegin;
+        int sourceEnd;
+        float prob;
+    };
+
+    std::string text;
+    QVector<Alignment> alignments;
+};
+
+/**
+ * Wrapper around a translation response from the bergamot service, or from
+ * the shared native messaging host. Hides those interfaces from the rest of
+ * the Qt code, and provides utility functions to access alignment
+ * information with character offsets instead of byte offsets.
  */
 class Translation {
 private:
     // Note: I would have liked unique_ptr, but that does not go well with
     // passing Translation objects through Qt signals/slots.
     std::shared_ptr<marian::bergamot::Response> response_;
+    std::shared_ptr<HostTranslation> hostTranslation_; // Instead of response_
 
     // Words per second as measured by runtime/word count in MarianInterface
     // @TODO this could probably be part of marian::bergamot::Response in the future
@@ -38,13 +59,14 @@ private:
 public:
     Translation();
     Translation(marian::bergamot::Response &&response, int speed);
+    Translation(HostTranslation &&translation, int speed);
 
     /**
      * Bool operator to check whether this is an initialised translation or just
      * an empty object.
      */
     inline operator bool() const {
-        return !!response_;
+        return response_ || hostTranslation_;
     }
 
     inline std::size_t wordsPerSecond() const {
@@ -52,7 +74,13 @@ public:
     }
 
     /**
-     * Translation result
+     * Translation result as UTF-8, as it came out of bergamot.
+     */
+    std::string const &translationUtf8() const;
+
+    /**
+     * Translation result converted to QString. This is a full UTF-8 to UTF-16
+     * conversion, so only call it where the text is handed to a widget.
      */
     QString translation() const;
 
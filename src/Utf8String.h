@@ -0,0 +1,96 @@
+#pragma once
+#include <QByteArray>
+#include <QString>
+#include <cctype>
+#include <string>
+#include <utility>
+
+/**
+ * UTF-8 encoded text as it travels between the I/O layer and bergamot, which
+ * works on UTF-8 std::strings internally. Text enters through one of the
+ * from*() helpers, is moved into the translator with release(), and only
+ * becomes a QString (UTF-16) when it reaches a widget through toQString().
+ * That way a megabyte of input is not re-encoded at every layer it passes.
+ */
+class Utf8String {
+private:
+    std::string bytes_;
+
+public:
+    Utf8String() = default;
+
+    explicit Utf8String(std::string &&bytes)
+    : bytes_(std::move(bytes)) {
+        //
+    }
+
+    /**
+     * Only for the widget boundary: QString is UTF-16 so this is a conversion.
+     */
+    static inline Utf8String fromQString(QString const &text) {
+        QByteArray utf8 = text.toUtf8();
+        return Utf8String(std::string(utf8.constData(), utf8.size()));
+    }
+
+    static inline Utf8String fromUtf8(char const *data, std::size_t size) {
+        return Utf8String(std::string(data, size));
+    }
+
+    static inline Utf8String fromUtf8(QByteArray const &utf8) {
+        return fromUtf8(utf8.constData(), utf8.size());
+    }
+
+    inline std::string const &str() const {
+        return bytes_;
+    }
+
+    inline std::string &str() {
+        return bytes_;
+    }
+
+    /**
+     * Moves the underlying string out, e.g. into `AsyncService::translate()`.
+     * Leaves this object empty.
+     */
+    inline std::string release() {
+        return std::move(bytes_);
+    }
+
+    inline bool isEmpty() const {
+        return bytes_.empty();
+    }
+
+    inline std::size_t size() const {
+        return bytes_.size();
+    }
+
+    inline void clear() {
+        bytes_.clear();
+    }
+
+    inline void append(char const *data, std::size_t size) {
+        bytes_.append(data, size);
+    }
+
+    /**
+     * Number of whitespace separated words. A cheap estimate of how much work
+     * translating this text is.
+     */
+    inline std::size_t countWords() const {
+        std::size_t numWords = 0;
+        bool inSpaces = true;
+        for (char c : bytes_) {
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                inSpaces = true;
+            } else if (inSpaces) {
+                ++numWords;
+                inSpaces = false;
+            }
+        }
+        return numWords;
+    }
+
+    inline QString toQString() const {
+        return QString::fromUtf8(bytes_.data(), static_cast<int>(bytes_.size()));
+    }
+};
@@ -10,7 +10,8 @@ namespace translateLocally {
 enum AppType {
     CLI,
     GUI,
-    NativeMsg
+    NativeMsg,
+    Serve
 };
 
 /**
@@ -29,9 +30,13 @@ static void CLIArgumentInit(QAppType& translateLocallyApp, QCommandLineParser& p
     parser.addOption({{"d", "download-model"}, QObject::tr("Connect to the Internet and download a model."), "output", ""});
     parser.addOption({{"r", "remove-model"}, QObject::tr("Remove a model from the local machine. Only works for models managed with translateLocally."), "output", ""});
     parser.addOption({{"m", "model"}, QObject::tr("Select model for translation."), "model", ""});
+    parser.addOption({{"s", "source"}, QObject::tr("Instead of -m, translate from this language with whichever installed models work out best, together with -t."), "lang", ""});
+    parser.addOption({{"t", "target"}, QObject::tr("Language to translate to, with -s."), "lang", ""});
+    parser.addOption({"prefer", QObject::tr("What to prefer when picking models with -s and -t: 'speed' (default) or 'quality'."), "what", "speed"});
     parser.addOption({{"i", "input"}, QObject::tr("Source translation file (or just used stdin)."), "input", ""});
     parser.addOption({{"o", "output"}, QObject::tr("Target translation file (or just used stdout)."), "output", ""});
     parser.addOption({{"p", "plugin"}, QObject::tr("Start native message server to use for a browser plugin.")});
+    parser.addOption({"serve", QObject::tr("Serve translations over HTTP on localhost, on the given port."), "port", ""});
     parser.addOption({"allow-client", QObject::tr("Add a native messaging client id that is allowed to use Native Messaging in the browser.")});
     parser.addOption({"remove-client", QObject::tr("Remove a native messaging client id.")});
     parser.addOption({"list-clients", QObject::tr("List allowed native messaging clients")});
@@ -101,8 +106,13 @@ static AppType runType(QCommandLineParser& parser) {
         return NativeMsg;
     }
 
+    // Local HTTP server
+    if (parser.isSet("serve")) {
+        return Serve;
+    }
+
     // Cli mode
-    QList<QString> cmdonlyflags = {"l", "a", "d", "r", "m", "i", "o", "allow-client", "remove-client", "update-manifests", "list-clients"};
+    QList<QString> cmdonlyflags = {"l", "a", "d", "r", "m", "s", "t", "i", "o", "allow-client", "remove-client", "update-manifests", "list-clients"};
     for (auto&& flag : cmdonlyflags) {
         if (parser.isSet(flag)) {
             return CLI;
@@ -2,9 +2,6 @@
 #include "cli/NativeMsgManager.h"
 #include <QFile>
 #include <QProcessEnvironment>
-#if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
-#include <QTextCodec>
-#endif
 
 #include <array>
 
@@ -23,6 +20,9 @@ namespace {
         if (parser.isSet("m"))
             command += QString(" -m %1").arg(parser.value("m"));
 
+        if (parser.isSet("s") && parser.isSet("t"))
+            command += QString(" -s %1 -t %2").arg(parser.value("s"), parser.value("t"));
+
         if (parser.isSet("i"))
             command += QString(" < \"%1\"").arg(parser.value("i"));
 
@@ -42,19 +42,7 @@ CommandLineIface::CommandLineIface(QObject * parent)
 , network_(this)
 , settings_(this)
 , models_(this, &settings_)
-, translator_(new MarianInterface(this))
-, instream_(stdin)
-, outstream_(stdout) {
-    // Take care of encoding according to https://doc.qt.io/qt-6/qtextstream.html#setAutoDetectUnicode
-#if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0)) // https://github.com/XapaJIaMnu/translateLocally/issues/121#issuecomment-1277762146
-    instream_.setCodec(QTextCodec::codecForName(QByteArray("UTF-8")));
-    outstream_.setCodec(QTextCodec::codecForName(QByteArray("UTF-8")));
-#else
-    instream_.setEncoding(QStringConverter::Encoding::Utf8);
-    outstream_.setEncoding(QStringConverter::Encoding::Utf8);
-#endif
-    instream_.setAutoDetectUnicode(true);
-    outstream_.setAutoDetectUnicode(true);
+, translator_(new MarianInterface(this)) {
     // Take care of slots and signals
     connect(translator_, &MarianInterface::error, this, &CommandLineIface::outputError);
     connect(translator_, &MarianInterface::translationReady, this, &CommandLineIface::outputTranslation);
@@ -67,7 +55,7 @@ int CommandLineIface::run(QCommandLineParser const &parser) {
         return 0;
     } else if (parser.isSet("a")) {
         connect(&models_, &ModelManager::fetchedRemoteModels, this, &CommandLineIface::printRemoteModels);
-        models_.fetchRemoteModels();
+        models_.refreshRemoteModels();
         eventLoop_.exec(); // Network operations take some time, therefore we need to wait for the remote models to be fetched and then exit
         return 0;
     } else if (parser.isSet("d")) {
@@ -98,47 +86,74 @@ int CommandLineIface::run(QCommandLineParser const &parser) {
         out << successstr;
         out.flush();
         return 0;
-    } else if (parser.isSet("m")) {
-        // Open file as input stream if necessary
+    } else if (parser.isSet("m") || parser.isSet("s") || parser.isSet("t")) {
+        // Either a model, or the languages to find one for, but not both.
+        if (parser.isSet("m") && (parser.isSet("s") || parser.isSet("t"))) {
+            qCritical().noquote() << "Use either -m, or -s and -t, but not both.";
+            return 5;
+        } else if (!parser.isSet("m") && parser.isSet("s") != parser.isSet("t")) {
+            qCritical().noquote() << "Use -s and -t together, to say which languages to translate from and to.";
+            return 5;
+        }
+
+        // Open file as input stream if necessary, otherwise read stdin
         if (parser.isSet("i")) {
             infile_.setFileName(parser.value("i"));
-            if (infile_.open(QIODevice::ReadOnly)) {
-                instream_.setDevice(&infile_);
-            } else {
+            if (!infile_.open(QIODevice::ReadOnly)) {
                 checkAppleSandbox(parser);
                 qCritical() << "Couldn't open input file:" + parser.value("i");
                 return 3;
             }
+        } else if (!infile_.open(stdin, QIODevice::ReadOnly)) {
+            qCritical() << "Couldn't open stdin for reading.";
+            return 3;
         }
 
         // Same, but output stream
         if (parser.isSet("o")) {
             outfile_.setFileName(parser.value("o"));
-            if (outfile_.open(QIODevice::WriteOnly)) {
-                outstream_.setDevice(&outfile_);
-            } else {
+            if (!outfile_.open(QIODevice::WriteOnly)) {
                 checkAppleSandbox(parser);
                 qCritical() << "Couldn't open output file:" + parser.value("o");
                 return 4;
             }
+        } else if (!outfile_.open(stdout, QIODevice::WriteOnly)) {
+            qCritical() << "Couldn't open stdout for writing.";
+            return 4;
         }
 
-        QString model_shortname = parser.value("model");
-
-        // Try to find our model in the list of models
         QString modelpath;
-        for (auto&& model : models_.getInstalledModels()) {
-            if (model.shortName == model_shortname) {
-                modelpath = model.path;
+        QString pivotpath;
+
+        if (parser.isSet("m")) {
+            QString model_shortname = parser.value("model");
+
+            // Try to find our model in the list of models
+            for (auto&& model : models_.getInstalledModels()) {
+                if (model.shortName == model_shortname) {
+                    modelpath = model.path;
+                }
             }
-        }
-        if (modelpath.isEmpty()) {
-            qCritical() << "We could not find a model identified as:" << model_shortname << ". Use translateLocally -l to list available models or use the GUI to download some from the internet.";
-            return 1;
+            if (modelpath.isEmpty()) {
+                qCritical() << "We could not find a model identified as:" << model_shortname << ". Use translateLocally -l to list available models or use the GUI to download some from the internet.";
+                return 1;
+            }
+        } else {
+            auto policy = parser.value("prefer") == "quality" ? translateLocally::models::BestQuality : translateLocally::models::Fastest;
+            auto route = models_.getRoute(parser.value("s"), parser.value("t"), policy);
+            if (!route) {
+                qCritical().noquote() << QString("None of the installed models translate from %1 to %2, not even via another language. Use translateLocally -a to list models available for download.").arg(parser.value("s"), parser.value("t"));
+                return 1;
+            }
+            modelpath = route->model.path;
+            if (route->pivot)
+                pivotpath = route->pivot->path;
         }
 
         // Init the translation model
-        translator_->setModel(modelpath, settings_.marianSettings());
+        // Nothing on the command line shows alignments, but HTML needs them
+        // to put the tags back into the translation.
+        translator_->setModel(modelpath, settings_.marianSettings(), parser.isSet("html"), pivotpath);
         doTranslation(parser.isSet("html"));
         return 0;
     } else if (parser.isSet("allow-client")) {
@@ -183,14 +198,23 @@ void CommandLineIface::printRemoteModels() {
  * @param buffer the buffer is where the lines to be translated are stored
  * @return
  */
-QString &CommandLineIface::fetchData(QString &buffer) {
+Utf8String &CommandLineIface::fetchData(Utf8String &buffer) {
     int counter = 0;
     buffer.clear();
-    static QString line;
     
-    while(counter < prefetchLines && instream_.readLineInto(&line)) {
-        buffer.append(line);
-        buffer.append('\n'); // The new line has no EoL characters
+    while (counter < prefetchLines) {
+        QByteArray line = infile_.readLine();
+        if (line.isEmpty()) // EOF (every other line has at least its newline)
+            break;
+
+        // Normalise line endings to a single '\n', also for the last line.
+        if (line.endsWith("\r\n"))
+            line.chop(2);
+        else if (line.endsWith('\n'))
+            line.chop(1);
+
+        buffer.append(line.constData(), line.size());
+        buffer.append("\n", 1);
         counter++;
     }
 
@@ -200,9 +224,13 @@ QString &CommandLineIface::fetchData(QString &buffer) {
  * @brief CommandLineIface::doTranslation This function is pseudo blocking, via an event loop. It sends text to be translated by marian.
  */
 void CommandLineIface::doTranslation(bool HTML) {
-    QString input;
+    // Input is taken to be UTF-8. Skip the byte order mark if there is one.
+    if (infile_.peek(3) == QByteArray("\xEF\xBB\xBF"))
+        infile_.read(3);
+
+    Utf8String input;
     while (!fetchData(input).isEmpty()) {
-        translator_->translate(input, HTML);
+        translator_->translate(std::move(input), HTML);
         // Start event loop to block unit translation is ready. Translator
         // will call outputTranslation or outputError during this call, which
         // will either unblock this exec() call, or kill the program.
@@ -213,7 +241,7 @@ void CommandLineIface::doTranslation(bool HTML) {
 void CommandLineIface::downloadRemoteModel(QString modelID) {
     // fetch model from the internet and wait until it is there
     connect(&models_, &ModelManager::fetchedRemoteModels, this, [&](){eventLoop_.exit();});
-    models_.fetchRemoteModels();
+    models_.refreshRemoteModels();
     eventLoop_.exec();
 
     // identify the model we want to download. This is a remote model and we have this complicated lambda function
@@ -244,14 +272,17 @@ void CommandLineIface::downloadRemoteModel(QString modelID) {
         fflush(stdout);
     });
     // Download the new model. Use eventloop again to prevent premature exit before download is finished
-    connect(&network_, &Network::downloadComplete, this, [&](QFile *file, QString filename) {
+    connect(&network_, &Network::streamComplete, this, [&](QIODevice *download, QString filename) {
+        models_.installModel(download, ModelMeta{}, filename); // TODO: ModelMeta
+    });
+    connect(&models_, &ModelManager::modelInstalled, this, [&]() {
         // We use cout here, as QTextStream out gives a warning about being lamda captured.
         std::cout << "\nModel downloaded successfully! You can now invoke it with -m " << modelID.toStdString() << std::endl;
-        models_.writeModel(file, ModelMeta{}, filename); // TODO: ModelMeta
         eventLoop_.exit();
     });
-    QNetworkReply *reply = network_.downloadFile(model.url, QCryptographicHash::Sha256, model.checksum);
-    if (reply == nullptr) {
+    connect(&models_, &ModelManager::installFailed, this, &CommandLineIface::outputError);
+    SegmentedDownload *download = models_.downloadModel(&network_, model);
+    if (download == nullptr) {
         outputError("Could not connect to the internet and download: " + model.url);
     }
     eventLoop_.exec();
@@ -263,8 +294,9 @@ void CommandLineIface::outputError(QString error) {
 }
 
 void CommandLineIface::outputTranslation(Translation output) {
-    outstream_ << output.translation();
-    outstream_.flush();
+    std::string const &text = output.translationUtf8();
+    outfile_.write(text.data(), text.size());
+    outfile_.flush();
     eventLoop_.exit(); // Unblock the main thread
 }
 
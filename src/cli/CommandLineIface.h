@@ -10,6 +10,7 @@
 #include "settings/Settings.h"
 #include "MarianInterface.h"
 #include "Translation.h"
+#include "Utf8String.h"
 #include "Network.h"
 
 class CommandLineIface : public QObject {
@@ -24,11 +25,11 @@ private:
     ModelManager models_;
     QPointer<MarianInterface> translator_;
 
-    // do_once file in and file out
+    // do_once file in and file out. Either opened on the -i/-o paths or on
+    // stdin/stdout. Read and written as raw UTF-8 so text reaches the
+    // translator (and comes back out) without a round trip through QString.
     QFile infile_;
     QFile outfile_;
-    QTextStream instream_;
-    QTextStream outstream_;
 
     static const int constexpr prefetchLines = 320;
 
@@ -36,7 +37,7 @@ private:
     void printLocalModels();
     void doTranslation(bool HTML);
     void downloadRemoteModel(QString modelID);
-    inline QString &fetchData(QString &);
+    inline Utf8String &fetchData(Utf8String &);
 
     int allowNativeMessagingClient(QStringList ids);
     int removeNativeMessagingClient(QStringList ids);
@@ -0,0 +1,81 @@
+#include "FrameWriter.h"
+#include <cstdint>
+
+FrameWriter::FrameWriter(std::ostream &out)
+: out_(out)
+, head_(nullptr)
+, stop_(false) {
+    thread_ = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+}
+
+void FrameWriter::write(QByteArray const &message) {
+    std::uint32_t size = static_cast<std::uint32_t>(message.size());
+
+    Node *node = new Node{QByteArray(), nullptr};
+    node->frame.reserve(sizeof(size) + message.size());
+    node->frame.append(reinterpret_cast<char const *>(&size), sizeof(size));
+    node->frame.append(message);
+
+    // Treiber stack push. The writer thread never pops single nodes, it swaps
+    // out the whole stack, so there is no ABA problem to worry about.
+    Node *head = head_.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+
+    // If the stack was not empty the writer is awake already, or about to
+    // find the frames that were there before this one.
+    if (head == nullptr) {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        wakeup_.notify_one();
+    }
+}
+
+void FrameWriter::run() {
+    for (;;) {
+        Node *newest = head_.exchange(nullptr, std::memory_order_acquire);
+
+        if (newest) {
+            writeAll(newest);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        if (stop_ && head_.load(std::memory_order_acquire) == nullptr)
+            break;
+
+        wakeup_.wait(lock, [this]() {
+            return stop_ || head_.load(std::memory_order_acquire) != nullptr;
+        });
+    }
+}
+
+void FrameWriter::writeAll(Node *newest) {
+    // The stack has the newest frame on top, reverse it to write oldest first.
+    Node *oldest = nullptr;
+    while (newest) {
+        Node *next = newest->next;
+        newest->next = oldest;
+        oldest = newest;
+        newest = next;
+    }
+
+    while (oldest) {
+        out_.write(oldest->frame.constData(), oldest->frame.size());
+        Node *next = oldest->next;
+        delete oldest;
+        oldest = next;
+    }
+
+    // One flush for however many frames piled up while we were writing.
+    out_.flush();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <QByteArray>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+/**
+ * Writes native messaging frames (a 4 byte native endian length followed by
+ * the message) to an output stream from a single thread of its own.
+ *
+ * Any thread can call write(). It only pushes the frame onto a lock-free
+ * stack; the writer thread takes everything pushed so far in one go, writes
+ * it in order and flushes once. Many small messages (e.g. download progress
+ * or streamed batch results) thus cost one flush instead of one each, and
+ * the threads producing them never wait for the pipe to the browser.
+ *
+ * Frames are written in the order in which write() returned, so a caller
+ * that serialises its own writes (e.g. updates before the final response)
+ * can rely on that order on the other side too.
+ */
+class FrameWriter {
+public:
+    explicit FrameWriter(std::ostream &out);
+
+    /**
+     * Writes out everything that was queued, then stops the writer thread.
+     */
+    ~FrameWriter();
+
+    FrameWriter(FrameWriter const &) = delete;
+    FrameWriter &operator=(FrameWriter const &) = delete;
+
+    /**
+     * @brief queue a message. It is framed here, on the calling thread.
+     */
+    void write(QByteArray const &message);
+
+private:
+    struct Node {
+        QByteArray frame;
+        Node *next;
+    };
+
+    void run();
+
+    // Writes the frames of a list taken off the stack, oldest first, and
+    // frees them.
+    void writeAll(Node *newest);
+
+    std::ostream &out_;
+    std::atomic<Node *> head_; // Most recently pushed frame
+    std::atomic<bool> stop_;
+
+    // Only used to sleep when there is nothing to write.
+    std::mutex sleepMutex_;
+    std::condition_variable wakeup_;
+
+    std::thread thread_;
+};
@@ -0,0 +1,262 @@
+#include "HttpServer.h"
+#include "cli/NativeMsgIface.h"
+#include <QHostAddress>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace {
+
+QByteArray reasonPhrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default:  return "Error";
+    }
+}
+
+// Same format as NativeMsgIface::writeError(), for errors that don't make
+// it that far.
+QByteArray errorJson(QString const &error, bool retryable = false) {
+    QJsonObject response{
+        {"success", false},
+        {"error", error}
+    };
+
+    if (retryable)
+        response["retryable"] = true;
+
+    return QJsonDocument(response).toJson(QJsonDocument::Compact);
+}
+
+// Anyone on this machine can connect, so only what it takes to translate.
+// Downloading or (un)loading models stays with native messaging, whose
+// clients the browser vets. Commands are spliced into the message as-is.
+bool isAllowedCommand(QByteArray const &name) {
+    return name == "Translate" || name == "TranslateBatch" || name == "ListModels";
+}
+
+// A web page whose host name resolves to 127.0.0.1 (DNS rebinding) still
+// sends its own host name, so only accept ours.
+bool isLocalHost(QByteArray const &host, quint16 port) {
+    QByteArray name = host;
+    int colon = host.lastIndexOf(':');
+    if (colon >= 0) {
+        if (host.mid(colon + 1) != QByteArray::number(port))
+            return false;
+        name = host.left(colon);
+    }
+
+    return name == "localhost" || name == "127.0.0.1";
+}
+
+} // Anonymous namespace
+
+HttpServer::HttpServer(NativeMsgIface *host, QObject *parent)
+: QObject(parent)
+, host_(host)
+, server_(this) {
+    connect(&server_, &QTcpServer::newConnection, this, &HttpServer::acceptConnections);
+}
+
+bool HttpServer::listen(quint16 port) {
+    // Nothing but this machine gets to use it.
+    return server_.listen(QHostAddress::LocalHost, port);
+}
+
+QString HttpServer::errorString() const {
+    return server_.errorString();
+}
+
+void HttpServer::acceptConnections() {
+    while (QTcpSocket *socket = server_.nextPendingConnection()) {
+        int channel = host_->openChannel([this, socket](QByteArray const &message, bool final) {
+            writeAnswer(socket, message, final);
+        });
+
+        connections_.insert(socket, Connection{channel});
+
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            readRequest(socket);
+        });
+
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            auto it = connections_.find(socket);
+            if (it == connections_.end())
+                return;
+
+            host_->closeChannel(it.value().channel);
+            connections_.erase(it);
+            socket->deleteLater();
+        });
+    }
+}
+
+void HttpServer::readRequest(QTcpSocket *socket) {
+    auto it = connections_.find(socket);
+    if (it == connections_.end())
+        return;
+
+    Connection &connection = it.value();
+
+    // One request at a time per connection, so the answers go out in order.
+    // Anything else that arrives waits in the socket.
+    while (!connection.busy) {
+        connection.buffer.append(socket->readAll());
+
+        int headerEnd = connection.buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            if (connection.buffer.size() > kMaxHttpHeaderLength) {
+                connection.keepAlive = false;
+                writeResponse(socket, 431, errorJson("Request header is too large"));
+            }
+            return;
+        }
+
+        QList<QByteArray> lines = connection.buffer.left(headerEnd).split('\n');
+        QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+        if (requestLine.size() != 3) {
+            connection.keepAlive = false;
+            return writeResponse(socket, 400, errorJson("Malformed request line"));
+        }
+
+        QByteArray method = requestLine[0];
+        QByteArray path = requestLine[1];
+        connection.keepAlive = requestLine[2] == "HTTP/1.1";
+
+        qint64 contentLength = 0;
+        QByteArray contentType, host;
+        bool hasOrigin = false;
+        for (auto &&line : lines) {
+            int colon = line.indexOf(':');
+            if (colon < 0)
+                continue;
+
+            QByteArray name = line.left(colon).trimmed().toLower();
+            QByteArray value = line.mid(colon + 1).trimmed().toLower();
+            if (name == "content-length") {
+                bool ok;
+                contentLength = value.toLongLong(&ok);
+                if (!ok || contentLength < 0) {
+                    connection.keepAlive = false;
+                    return writeResponse(socket, 400, errorJson("Invalid Content-Length"));
+                }
+            } else if (name == "connection") {
+                if (value == "close")
+                    connection.keepAlive = false;
+                else if (value == "keep-alive")
+                    connection.keepAlive = true;
+            } else if (name == "content-type") {
+                contentType = value.split(';').first().trimmed();
+            } else if (name == "host") {
+                host = value;
+            } else if (name == "origin") {
+                hasOrigin = true;
+            } else if (name == "transfer-encoding") {
+                connection.keepAlive = false;
+                return writeResponse(socket, 411, errorJson("Chunked requests are not supported, send a Content-Length"));
+            }
+        }
+
+        if (contentLength >= kMaxInputLength) {
+            connection.keepAlive = false;
+            return writeResponse(socket, 413, errorJson("Request body is too large"));
+        }
+
+        int bodyBegin = headerEnd + 4;
+        if (connection.buffer.size() < bodyBegin + contentLength)
+            return; // Wait for the rest of the body
+
+        QByteArray body = connection.buffer.mid(bodyBegin, static_cast<int>(contentLength));
+        connection.buffer.remove(0, bodyBegin + static_cast<int>(contentLength));
+
+        // Browsers add an Origin to every cross-site POST, and can't send
+        // JSON to another site without asking first. Scripts and tools
+        // don't send an Origin.
+        if (method != "POST") {
+            writeResponse(socket, 405, errorJson("Use POST"));
+        } else if (hasOrigin) {
+            writeResponse(socket, 403, errorJson("Requests from web pages are not allowed"));
+        } else if (!isLocalHost(host, server_.serverPort())) {
+            writeResponse(socket, 403, errorJson("Host has to be localhost or 127.0.0.1"));
+        } else if (contentType != "application/json") {
+            writeResponse(socket, 415, errorJson("Content-Type has to be application/json"));
+        } else if (!isAllowedCommand(path.mid(1))) {
+            writeResponse(socket, 404, errorJson("Path has to be /Translate, /TranslateBatch or /ListModels"));
+        } else {
+            if (body.trimmed().isEmpty())
+                body = "{}";
+
+            // Wrap the body in a native messaging message. Parsed first, as
+            // the body spliced in as-is could bring its own "command" and
+            // get past isAllowedCommand().
+            QJsonParseError error;
+            QJsonDocument data = QJsonDocument::fromJson(body, &error);
+            if (error.error != QJsonParseError::NoError || !data.isObject()) {
+                writeResponse(socket, 400, errorJson("Request body has to be a JSON object"));
+            } else {
+                QJsonObject message{
+                    {"id", connection.nextID++},
+                    {"command", QString::fromLatin1(path.mid(1))},
+                    {"data", data.object()}
+                };
+
+                connection.busy = host_->submit(connection.channel, QJsonDocument(message).toJson(QJsonDocument::Compact));
+                if (!connection.busy)
+                    writeResponse(socket, 503, errorJson("Too much input is waiting to be translated", true));
+            }
+        }
+
+        if (!connection.keepAlive)
+            return;
+    }
+}
+
+void HttpServer::writeResponse(QTcpSocket *socket, int status, QByteArray const &body) {
+    bool keepAlive = connections_.value(socket).keepAlive;
+
+    QByteArray header;
+    header.append("HTTP/1.1 ");
+    header.append(QByteArray::number(status));
+    header.append(' ');
+    header.append(reasonPhrase(status));
+    header.append("\r\nContent-Type: application/json\r\nContent-Length: ");
+    header.append(QByteArray::number(body.size()));
+    header.append(keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+
+    socket->write(header);
+    socket->write(body);
+
+    if (!keepAlive)
+        socket->disconnectFromHost();
+}
+
+void HttpServer::writeAnswer(QTcpSocket *socket, QByteArray const &message, bool final) {
+    if (!final)
+        return; // No updates over HTTP
+
+    auto it = connections_.find(socket);
+    if (it == connections_.end())
+        return;
+
+    it.value().busy = false;
+    bool keepAlive = it.value().keepAlive;
+
+    QJsonObject response = QJsonDocument::fromJson(message).object();
+    int status = 200;
+    if (!response.value("success").toBool())
+        status = response.value("retryable").toBool() ? 503 : 400;
+
+    writeResponse(socket, status, message);
+
+    // Pick up requests that were sent while this one was being answered.
+    if (keepAlive)
+        readRequest(socket);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+class NativeMsgIface;
+
+const int constexpr kMaxHttpHeaderLength = 16 * 1024; // Bytes of request line and headers we accept
+
+/**
+ * Translation endpoint on localhost for scripts and build tooling, so they
+ * don't have to start translateLocally and load a model for every text.
+ *
+ * The Translate, TranslateBatch and ListModels native messaging commands are
+ * available as `POST /<command>` with the command's "data" object as the
+ * body, e.g.:
+ *
+ *   POST /Translate HTTP/1.1
+ *   Host: localhost:8080
+ *   Content-Type: application/json
+ *   Content-Length: 45
+ *
+ *   {"src": "en", "trg": "de", "text": "Hello"}
+ *
+ * There is no authentication, so to keep web pages from using it, requests
+ * with an Origin header, with a Host other than localhost or 127.0.0.1, or
+ * with a Content-Type other than application/json are refused.
+ *
+ * The body of the response is the native messaging response, see
+ * NativeMsgIface.h for the formats. The status is 200 if it succeeded, 503
+ * if the host is too busy and the request can be retried, and 400 for any
+ * other error. Updates (e.g. download progress, streamed batch items) are
+ * not sent, so there is no point in "stream" here.
+ *
+ * Connections are kept alive unless the client asks otherwise. Requests on
+ * one connection are answered in order; send them on several connections to
+ * have them translated at the same time. All connections share the models,
+ * caches and workers of one NativeMsgIface.
+ */
+class HttpServer : public QObject {
+    Q_OBJECT
+
+public:
+    HttpServer(NativeMsgIface *host, QObject *parent = nullptr);
+
+    /**
+     * @brief starts accepting connections on localhost only.
+     * @return false if the port is not available.
+     */
+    bool listen(quint16 port);
+
+    QString errorString() const;
+
+private slots:
+    void acceptConnections();
+
+private:
+    struct Connection {
+        int channel;
+        QByteArray buffer; // Received, but not handled yet
+        bool busy{false}; // Waiting for the answer to a request
+        bool keepAlive{true};
+        int nextID{0};
+    };
+
+    /**
+     * @brief handles the next complete request in the buffer, unless the
+     * previous one is still being answered.
+     */
+    void readRequest(QTcpSocket *socket);
+
+    /**
+     * @brief writes a response with a JSON body, and closes the connection
+     * afterwards unless it is kept alive.
+     */
+    void writeResponse(QTcpSocket *socket, int status, QByteArray const &body);
+
+    /**
+     * @brief hooked to the NativeMsgIface channel of a connection.
+     */
+    void writeAnswer(QTcpSocket *socket, QByteArray const &message, bool final);
+
+    NativeMsgIface *host_;
+    QTcpServer server_;
+    QHash<QTcpSocket *, Connection> connections_;
+};
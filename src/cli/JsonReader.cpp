@@ -0,0 +1,218 @@
+#include "JsonReader.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+void appendCodepoint(std::string &out, unsigned int cp) {
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+} // Anonymous namespace
+
+JsonReader::JsonReader(char const *data, std::size_t size)
+: pos_(data)
+, end_(data + size) {
+    //
+}
+
+void JsonReader::skipWhitespace() {
+    while (pos_ != end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t'))
+        ++pos_;
+}
+
+char JsonReader::peek() {
+    skipWhitespace();
+    return pos_ == end_ ? '\0' : *pos_;
+}
+
+bool JsonReader::consume(char c) {
+    if (peek() != c)
+        return false;
+    ++pos_;
+    return true;
+}
+
+bool JsonReader::atEnd() {
+    skipWhitespace();
+    return pos_ == end_;
+}
+
+bool JsonReader::readHex4(unsigned int &out) {
+    if (end_ - pos_ < 4)
+        return false;
+
+    out = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = *pos_++;
+        out <<= 4;
+        if (c >= '0' && c <= '9')
+            out |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            out |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            out |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+bool JsonReader::copyUtf8(char const *begin, char const *end, std::string &out) {
+    auto const *p = reinterpret_cast<unsigned char const *>(begin);
+    auto const *e = reinterpret_cast<unsigned char const *>(end);
+
+    while (p != e) {
+        if (*p < 0x80) {
+            ++p;
+            continue;
+        }
+
+        // Length of the sequence, and the lowest code point it may encode
+        // (anything lower is an overlong encoding).
+        std::size_t length;
+        unsigned int cp, min;
+        if ((*p & 0xE0) == 0xC0) {
+            length = 2; cp = *p & 0x1F; min = 0x80;
+        } else if ((*p & 0xF0) == 0xE0) {
+            length = 3; cp = *p & 0x0F; min = 0x800;
+        } else if ((*p & 0xF8) == 0xF0) {
+            length = 4; cp = *p & 0x07; min = 0x10000;
+        } else {
+            return false;
+        }
+
+        if (static_cast<std::size_t>(e - p) < length)
+            return false;
+
+        for (std::size_t i = 1; i < length; ++i) {
+            if ((p[i] & 0xC0) != 0x80)
+                return false;
+            cp = (cp << 6) | (p[i] & 0x3F);
+        }
+
+        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+            return false;
+
+        p += length;
+    }
+
+    out.append(begin, end - begin);
+    return true;
+}
+
+bool JsonReader::readString(std::string &out) {
+    if (!consume('"'))
+        return false;
+
+    out.clear();
+
+    for (;;) {
+        // Copy everything up to the next quote or escape in one go.
+        char const *run = pos_;
+        while (pos_ != end_ && *pos_ != '"' && *pos_ != '\\') {
+            if (static_cast<unsigned char>(*pos_) < 0x20)
+                return false; // Control characters have to be escaped
+            ++pos_;
+        }
+
+        if (!copyUtf8(run, pos_, out))
+            return false;
+
+        if (pos_ == end_)
+            return false;
+
+        if (*pos_++ == '"')
+            return true;
+
+        // Escape sequence
+        if (pos_ == end_)
+            return false;
+
+        switch (*pos_++) {
+            case '"':  out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/':  out.push_back('/'); break;
+            case 'b':  out.push_back('\b'); break;
+            case 'f':  out.push_back('\f'); break;
+            case 'n':  out.push_back('\n'); break;
+            case 'r':  out.push_back('\r'); break;
+            case 't':  out.push_back('\t'); break;
+            case 'u': {
+                unsigned int cp;
+                if (!readHex4(cp))
+                    return false;
+
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    // High surrogate, has to be followed by an escaped low one.
+                    unsigned int low;
+                    if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u')
+                        return false;
+                    pos_ += 2;
+                    if (!readHex4(low) || low < 0xDC00 || low > 0xDFFF)
+                        return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;
+                }
+
+                appendCodepoint(out, cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+}
+
+bool JsonReader::readNumber(double &out) {
+    skipWhitespace();
+
+    // strtod() needs a terminated string and accepts more than JSON does
+    // (hex, inf, nan), so only hand it what looks like a JSON number.
+    char buffer[32];
+    std::size_t length = 0;
+    while (pos_ != end_ && length < sizeof(buffer) - 1) {
+        char c = *pos_;
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')
+            buffer[length++] = *pos_++;
+        else
+            break;
+    }
+
+    if (length == 0 || length == sizeof(buffer) - 1)
+        return false;
+
+    buffer[length] = '\0';
+    char *parsed;
+    out = std::strtod(buffer, &parsed);
+    return parsed == buffer + length;
+}
+
+bool JsonReader::readBool(bool &out) {
+    skipWhitespace();
+    if (end_ - pos_ >= 4 && std::memcmp(pos_, "true", 4) == 0) {
+        pos_ += 4;
+        out = true;
+        return true;
+    } else if (end_ - pos_ >= 5 && std::memcmp(pos_, "false", 5) == 0) {
+        pos_ += 5;
+        out = false;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * Minimal pull parser for JSON that is already UTF-8, such as native
+ * messaging input. Unlike QJsonDocument::fromJson() it does not convert
+ * strings to UTF-16 (QString) and back, so a large text can go straight
+ * into a Utf8String.
+ *
+ * It only does what the fast paths need and reports failure for anything
+ * else, after which the caller is expected to fall back to QJsonDocument
+ * (which also produces a proper error message).
+ */
+class JsonReader {
+public:
+    JsonReader(char const *data, std::size_t size);
+
+    /**
+     * @brief next non-whitespace character without consuming it, or '\0' at
+     * the end of the input.
+     */
+    char peek();
+
+    /**
+     * @brief consumes `c` (after any whitespace) if it is the next character.
+     */
+    bool consume(char c);
+
+    /**
+     * @brief reads a string, unescaping it into UTF-8. Fails on invalid
+     * UTF-8 and on escaped lone surrogates.
+     */
+    bool readString(std::string &out);
+
+    bool readNumber(double &out);
+
+    bool readBool(bool &out);
+
+    /**
+     * @brief true if there is nothing but whitespace left.
+     */
+    bool atEnd();
+
+private:
+    void skipWhitespace();
+
+    // Reads the four hex digits of a \u escape.
+    bool readHex4(unsigned int &out);
+
+    // Copies a run of unescaped characters, checking that it is valid UTF-8.
+    bool copyUtf8(char const *begin, char const *end, std::string &out);
+
+    char const *pos_;
+    char const *end_;
+};
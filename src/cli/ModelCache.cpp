@@ -0,0 +1,106 @@
+#include "ModelCache.h"
+#include <QDebug>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <iterator>
+#include <limits>
+
+ModelCache::ModelCache(std::size_t budget)
+: budget_(budget)
+, used_(0) {
+    //
+}
+
+ModelCache::ModelPtr ModelCache::get(QString const &id) {
+    auto it = index_.find(id);
+    if (it == index_.end())
+        return nullptr;
+
+    // Move entry to the front of the list. Iterators stay valid with splice.
+    entries_.splice(entries_.begin(), entries_, it.value());
+    return entries_.front().model;
+}
+
+void ModelCache::insert(QString const &id, ModelPtr model, std::size_t size) {
+    remove(id);
+
+    entries_.push_front(Entry{id, std::move(model), size});
+    index_.insert(id, entries_.begin());
+    used_ += size;
+
+    evict();
+}
+
+bool ModelCache::remove(QString const &id) {
+    auto it = index_.find(id);
+    if (it == index_.end())
+        return false;
+
+    used_ -= it.value()->size;
+    entries_.erase(it.value());
+    index_.erase(it);
+    return true;
+}
+
+bool ModelCache::contains(QString const &id) const {
+    return index_.contains(id);
+}
+
+std::vector<std::pair<QString, std::size_t>> ModelCache::contents() const {
+    std::vector<std::pair<QString, std::size_t>> contents;
+    contents.reserve(entries_.size());
+    for (auto &&entry : entries_)
+        contents.emplace_back(entry.id, entry.size);
+    return contents;
+}
+
+void ModelCache::setBudget(std::size_t budget) {
+    budget_ = budget;
+    evict();
+}
+
+void ModelCache::setDemand(DemandFunction demand) {
+    demand_ = std::move(demand);
+}
+
+std::list<ModelCache::Entry>::iterator ModelCache::victim() {
+    auto oldest = std::prev(entries_.end());
+    if (!demand_)
+        return oldest;
+
+    // Walk from least to most recently used, skipping the front entry, which
+    // is the model we just inserted or used.
+    auto best = oldest;
+    std::size_t bestDemand = std::numeric_limits<std::size_t>::max();
+    for (auto it = oldest; it != entries_.begin(); --it) {
+        std::size_t demand = demand_(it->id);
+        if (demand == 0)
+            return it;
+        if (demand < bestDemand) {
+            best = it;
+            bestDemand = demand;
+        }
+    }
+    return best;
+}
+
+void ModelCache::evict() {
+    // Never evict the front entry, which is the model we just inserted or used.
+    while (used_ > budget_ && entries_.size() > 1) {
+        auto it = victim();
+        qDebug() << "Unloading model" << it->id << "to stay within the model memory budget";
+        used_ -= it->size;
+        index_.remove(it->id);
+        entries_.erase(it);
+    }
+}
+
+std::size_t ModelCache::measureModel(QString const &path) {
+    std::size_t size = 0;
+    QDirIterator it(path, QDir::Files);
+    while (it.hasNext()) {
+        it.next();
+        size += it.fileInfo().size();
+    }
+    return size;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <QHash>
+#include <QString>
+#include <functional>
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// If we include the actual header, we break QT compilation.
+namespace marian {
+    namespace bergamot {
+    class TranslationModel;
+    }
+}
+
+/**
+ * LRU cache of loaded translation models keyed by model id. The cache is
+ * bounded by a memory budget: every model is accounted for with the size it
+ * occupies on disk (see measureModel()), and models are dropped once the sum
+ * exceeds the budget. Models without queued work (see setDemand()) go
+ * first, least recently used first; otherwise the one with the least queued
+ * work goes. The most recently used model is never evicted, so a single
+ * model larger than the budget still works.
+ *
+ * Dropping a model from the cache only releases the cache's reference. Any
+ * translation still queued in the service keeps its own shared pointer.
+ */
+class ModelCache {
+public:
+    using ModelPtr = std::shared_ptr<marian::bergamot::TranslationModel>;
+    using DemandFunction = std::function<std::size_t(QString const &)>;
+
+    explicit ModelCache(std::size_t budget);
+
+    /**
+     * @brief Look up a model and mark it as most recently used.
+     * @return the model or nullptr if it is not loaded.
+     */
+    ModelPtr get(QString const &id);
+
+    /**
+     * @brief Add a freshly loaded model. Evicts least recently used models
+     * until the cache fits its budget again.
+     * @param size memory accounted for this model, in bytes.
+     */
+    void insert(QString const &id, ModelPtr model, std::size_t size);
+
+    /**
+     * @brief Drop a model from the cache.
+     * @return whether the model was in the cache.
+     */
+    bool remove(QString const &id);
+
+    bool contains(QString const &id) const;
+
+    void setBudget(std::size_t budget);
+
+    /**
+     * @brief Tells the cache how much work is waiting for a model, so it
+     * doesn't evict a model that is about to be used again.
+     */
+    void setDemand(DemandFunction demand);
+
+    inline std::size_t budget() const {
+        return budget_;
+    }
+
+    /**
+     * @brief Sum of the sizes of all cached models, in bytes.
+     */
+    inline std::size_t used() const {
+        return used_;
+    }
+
+    /**
+     * @brief Ids and sizes of all cached models, most recently used first.
+     */
+    std::vector<std::pair<QString, std::size_t>> contents() const;
+
+    /**
+     * @brief Estimates the memory a model will take by summing the sizes of
+     * the files in its directory, which is what gets loaded into memory.
+     */
+    static std::size_t measureModel(QString const &path);
+
+private:
+    struct Entry {
+        QString id;
+        ModelPtr model;
+        std::size_t size;
+    };
+
+    void evict();
+
+    // Entry to evict next. Never the front one.
+    std::list<Entry>::iterator victim();
+
+    std::list<Entry> entries_; // Most recently used first
+    QHash<QString, std::list<Entry>::iterator> index_;
+    std::size_t budget_;
+    std::size_t used_;
+    DemandFunction demand_;
+};
@@ -1,13 +1,24 @@
 #include "NativeMsgIface.h"
+#include "cli/JsonReader.h"
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <QCryptographicHash>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QSet>
 #include <QThread>
+#include <QSaveFile>
+#include <QTimer>
 #include <QAbstractEventDispatcher>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <utility>
 #include <QNetworkReply>
 
 // bergamot-translator
@@ -32,12 +43,320 @@ template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 // Explicit deduction guide (not needed as of C++20)
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
-std::shared_ptr<marian::Options> makeOptions(const std::string &path_to_model_dir, const translateLocally::marianSettings &settings) {
+// Ids of the models a model instance translates with.
+std::vector<std::string> modelIDs(ModelInstance const &instance) {
+    return std::visit(overloaded {
+        [](DirectModelInstance const &model) {
+            return std::vector<std::string>{model.modelID.toStdString()};
+        },
+        [](PivotModelInstance const &model) {
+            return std::vector<std::string>{model.modelID.toStdString(), model.pivotID.toStdString()};
+        }
+    }, instance);
+}
+
+const QString kAlignmentSuffix = QStringLiteral("+alignment");
+
+// Reads a string member into a QString. Fine for the short fields, the text
+// itself is kept as UTF-8.
+bool readQString(JsonReader &reader, QString &out) {
+    std::string value;
+    if (!reader.readString(value))
+        return false;
+    out = QString::fromStdString(value);
+    return true;
+}
+
+bool readInt(JsonReader &reader, int &out) {
+    double value;
+    if (!reader.readNumber(value))
+        return false;
+
+    // Casting anything outside the range of int is undefined, so check first.
+    if (!std::isfinite(value)
+        || value < std::numeric_limits<int>::min()
+        || value > std::numeric_limits<int>::max()
+        || value != std::trunc(value))
+        return false;
+    out = static_cast<int>(value);
+    return true;
+}
+
+bool readTranslationData(JsonReader &reader, TranslationRequest &request, bool &hasText) {
+    if (!reader.consume('{'))
+        return false;
+
+    if (reader.consume('}'))
+        return true;
+
+    do {
+        std::string key;
+        if (!reader.readString(key) || !reader.consume(':'))
+            return false;
+
+        bool ok;
+        if (key == "text") {
+            std::string text;
+            ok = hasText = reader.readString(text);
+            request.text = Utf8String(std::move(text));
+        } else if (key == "src") {
+            ok = readQString(reader, request.src);
+        } else if (key == "trg") {
+            ok = readQString(reader, request.trg);
+        } else if (key == "model") {
+            ok = readQString(reader, request.model);
+        } else if (key == "pivot") {
+            ok = readQString(reader, request.pivot);
+        } else if (key == "prefer") {
+            QString prefer;
+            ok = readQString(reader, prefer);
+            request.setPolicy(prefer);
+        } else if (key == "session") {
+            ok = readQString(reader, request.session);
+        } else if (key == "html") {
+            ok = reader.readBool(request.html);
+        } else if (key == "quality") {
+            ok = reader.readBool(request.quality);
+        } else if (key == "alignments") {
+            ok = reader.readBool(request.alignments);
+        } else if (key == "priority") {
+            ok = readInt(reader, request.priority);
+        } else if (key == "deadline") {
+            ok = readInt(reader, request.deadline);
+        } else {
+            ok = false;
+        }
+
+        if (!ok)
+            return false;
+    } while (reader.consume(','));
+
+    return reader.consume('}');
+}
+
+/**
+ * Fast path for Translate requests, the most frequent and largest messages.
+ * Reads the text straight into UTF-8 instead of going through QJsonDocument
+ * and QString. Returns nothing for anything it does not understand, including
+ * malformed requests, so the caller can fall back to the full parser.
+ */
+std::optional<TranslationRequest> parseTranslationRequest(QByteArray const &input) {
+    JsonReader reader(input.constData(), input.size());
+    TranslationRequest request;
+    std::string command;
+    bool hasID = false, hasData = false, hasText = false;
+
+    if (!reader.consume('{'))
+        return std::nullopt;
+
+    do {
+        std::string key;
+        if (!reader.readString(key) || !reader.consume(':'))
+            return std::nullopt;
+
+        bool ok;
+        if (key == "command") {
+            ok = reader.readString(command);
+        } else if (key == "id") {
+            ok = hasID = readInt(reader, request.id);
+        } else if (key == "data") {
+            ok = hasData = readTranslationData(reader, request, hasText);
+        } else {
+            ok = false;
+        }
+
+        if (!ok)
+            return std::nullopt;
+    } while (reader.consume(','));
+
+    if (!reader.consume('}') || !reader.atEnd())
+        return std::nullopt;
+
+    if (command != "Translate" || !hasID || !hasData || !hasText)
+        return std::nullopt;
+
+    if ((!request.src.isEmpty() && !request.trg.isEmpty()) == (!request.model.isEmpty()))
+        return std::nullopt;
+
+    return request;
+}
+
+/**
+ * Converts byte offsets in UTF-8 text into offsets in UTF-16 code units, which
+ * is how JavaScript indexes strings. Walks the text incrementally, so offsets
+ * should be asked for in roughly increasing order. Asking for an offset before
+ * the last mark() restarts from the beginning of the text.
+ */
+class Utf16Offsets {
+public:
+    explicit Utf16Offsets(std::string const &text)
+    : text_(text) {
+        //
+    }
+
+    int operator()(std::size_t offset) {
+        offset = std::min(offset, text_.size());
+
+        if (offset < byte_) {
+            if (offset < markByte_)
+                markByte_ = markUnit_ = 0;
+            byte_ = markByte_;
+            unit_ = markUnit_;
+        }
+
+        for (; byte_ < offset; ++byte_) {
+            unsigned char c = text_[byte_];
+            if ((c & 0xC0) != 0x80) // Not a continuation byte
+                unit_ += c >= 0xF0 ? 2 : 1; // Four byte sequences need a surrogate pair
+        }
+
+        return static_cast<int>(unit_);
+    }
+
+    // Remember the current position, e.g. the start of a sentence, so going
+    // back to anywhere after it is cheap.
+    void mark() {
+        markByte_ = byte_;
+        markUnit_ = unit_;
+    }
+
+private:
+    std::string const &text_;
+    std::size_t byte_{0}, unit_{0};
+    std::size_t markByte_{0}, markUnit_{0};
+};
+
+// Scores and probabilities don't need more precision than this, and shorter
+// numbers make for smaller messages.
+double roundScore(float score) {
+    return std::round(score * 1000.0) / 1000.0;
+}
+
+/**
+ * Quality scores as {"sentences": [[begin, end, score], ...], "words": [[begin, end, score], ...]}
+ * with offsets into the target text.
+ */
+QJsonObject qualityToJson(marian::bergamot::Response const &response, Utf16Offsets &target) {
+    QJsonArray sentences, words;
+
+    for (std::size_t sentenceIdx = 0; sentenceIdx < response.qualityScores.size(); ++sentenceIdx) {
+        auto const &quality = response.qualityScores[sentenceIdx];
+        auto sentence = response.target.sentenceAsByteRange(sentenceIdx);
+        sentences.append(QJsonArray{target(sentence.begin), target(sentence.end), roundScore(quality.sequence)});
+
+        // Word scores are for whole words, while the annotation has subword
+        // tokens. A new word starts at every token that starts with a space,
+        // the same way the quality estimator groups them.
+        std::vector<marian::bergamot::ByteRange> spans;
+        for (std::size_t wordIdx = 0; wordIdx < response.target.numWords(sentenceIdx); ++wordIdx) {
+            auto token = response.target.wordAsByteRange(sentenceIdx, wordIdx);
+            if (token.size() == 0)
+                continue;
+            
+            if (spans.empty() || std::isspace(static_cast<unsigned char>(response.target.text[token.begin])))
+                spans.push_back(marian::bergamot::ByteRange{token.begin, token.end});
+            else
+                spans.back().end = token.end;
+        }
+
+        // If the grouping does not match up, rather leave out the words than
+        // attach scores to the wrong ones.
+        if (spans.size() != quality.word.size())
+            continue;
+
+        for (std::size_t wordIdx = 0; wordIdx < spans.size(); ++wordIdx) {
+            std::size_t begin = spans[wordIdx].begin;
+            while (begin < spans[wordIdx].end && std::isspace(static_cast<unsigned char>(response.target.text[begin])))
+                ++begin;
+            words.append(QJsonArray{target(begin), target(spans[wordIdx].end), roundScore(quality.word[wordIdx])});
+        }
+    }
+
+    return QJsonObject{
+        {"sentences", sentences},
+        {"words", words}
+    };
+}
+
+/**
+ * Alignments as [[target begin, target end, source begin, source end, probability], ...]
+ * with for every target token only its kMaxAlignmentsPerToken most likely source
+ * tokens, and only if they are at least kMinAlignmentProbability.
+ */
+QJsonArray alignmentsToJson(marian::bergamot::Response const &response, Utf16Offsets &target, Utf16Offsets &source) {
+    QJsonArray alignments;
+    std::vector<std::pair<float, std::size_t>> candidates;
+
+    // response.alignments[sentence:size_t][target token:size_t][source token:size_t] = probability:float
+    for (std::size_t sentenceIdx = 0; sentenceIdx < response.alignments.size(); ++sentenceIdx) {
+        auto const &matrix = response.alignments[sentenceIdx];
+
+        source(response.source.sentenceAsByteRange(sentenceIdx).begin);
+        source.mark();
+
+        for (std::size_t t = 0; t < matrix.size(); ++t) {
+            candidates.clear();
+            for (std::size_t s = 0; s < matrix[t].size(); ++s)
+                if (matrix[t][s] >= kMinAlignmentProbability)
+                    candidates.emplace_back(matrix[t][s], s);
+
+            if (candidates.empty())
+                continue;
+
+            std::size_t k = std::min(candidates.size(), kMaxAlignmentsPerToken);
+            std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), std::greater<>());
+
+            auto targetSpan = response.target.wordAsByteRange(sentenceIdx, t);
+            int targetBegin = target(targetSpan.begin);
+            int targetEnd = target(targetSpan.end);
+
+            for (std::size_t i = 0; i < k; ++i) {
+                auto sourceSpan = response.source.wordAsByteRange(sentenceIdx, candidates[i].second);
+                alignments.append(QJsonArray{
+                    targetBegin,
+                    targetEnd,
+                    source(sourceSpan.begin),
+                    source(sourceSpan.end),
+                    roundScore(candidates[i].first)
+                });
+            }
+        }
+    }
+
+    return alignments;
+}
+
+/**
+ * The "target" object of a translation response. Quality scores and alignments
+ * are only included if they were asked for (and thus computed).
+ */
+QJsonObject targetToJson(marian::bergamot::Response &&response, bool quality, bool alignments) {
+    QJsonObject target;
+
+    if (quality || alignments) {
+        Utf16Offsets targetOffsets(response.target.text);
+        Utf16Offsets sourceOffsets(response.source.text);
+
+        if (quality)
+            target["quality"] = qualityToJson(response, targetOffsets);
+
+        if (alignments)
+            target["alignments"] = alignmentsToJson(response, targetOffsets, sourceOffsets);
+    }
+
+    target["text"] = QString::fromStdString(std::move(response.target.text));
+    return target;
+}
+
+// Alignments cost attention extraction during decoding and a matrix per
+// sentence in memory, so models only compute them when asked to. HTML
+// translation needs them too, to put the markup back in place.
+std::shared_ptr<marian::Options> makeOptions(const std::string &path_to_model_dir, const translateLocally::marianSettings &settings, bool alignment) {
     std::shared_ptr<marian::Options> options(marian::bergamot::parseOptionsFromFilePath(path_to_model_dir + "/config.intgemm8bitalpha.yml"));
     options->set("cpu-threads", settings.cpu_threads,
                  "workspace", settings.workspace,
                  "mini-batch-words", 1000,
-                 "alignment", "soft",
+                 "alignment", alignment ? "soft" : "",
                  "quiet", true);
     return options;
 }
@@ -56,6 +375,19 @@ QMetaObject::Connection connectSingleShot(Sender *sender, void (Emitter::*signal
 #endif
 }
 
+// Prepares stdin and stdout for native messaging and returns stdout. Called
+// while initialising the writer, before its thread can write to stdout.
+std::ostream &setupStdio() {
+    // Disable synchronisation with C style streams. That should make IO faster
+    std::ios_base::sync_with_stdio(false);
+
+    // Decouple cin from cout so we can read and write (and flush) them
+    // independently.
+    std::cin.tie(NULL);
+
+    return std::cout;
+}
+
 // Little helper to print QSet<QString> and QList<QString> without the need to
 // convert them into a QStringList.
 template <typename T>
@@ -73,17 +405,20 @@ QString join(QString glue, T const &list) {
 
 NativeMsgIface::NativeMsgIface(QObject * parent) :
       QObject(parent)
-      , network_(this)
+      , writer_(setupStdio())
+      , operations_(0)
+      , queuedBytes_(0)
+      , maxQueuedBytes_(0)
       , settings_(this)
+      , network_(this)
       , models_(this, &settings_)
-      , operations_(0)
+      , modelCache_(static_cast<std::size_t>(settings_.modelCacheMemory()) * 1024 * 1024)
+      , responseCache_(settings_.marianSettings().translation_cache ? kResponseCacheMemory : 0)
+      , scheduler_(settings_.marianSettings().cpu_threads * kMaxWordsInFlightPerWorker, kSessionQuantum, kModelAffinityDelay)
+      , maxQueuedWords_(settings_.maxQueuedWords())
     {    
-    // Disable synchronisation with C style streams. That should make IO faster
-    std::ios_base::sync_with_stdio(false);
-
-    // Decouple cin from cout so we can read and write (and flush) them
-    // independently.
-    std::cin.tie(NULL);
+    // settings_ is initialised after the admission control members.
+    maxQueuedBytes_ = static_cast<std::size_t>(settings_.inputQueueMemory()) * 1024 * 1024;
 
     // Init the marian translation service:
     marian::bergamot::AsyncService::Config serviceConfig;
@@ -96,19 +431,29 @@ NativeMsgIface::NativeMsgIface(QObject * parent) :
     // fetchRemoteModels() might also hook into this, and those can yield multiple
     // errors for one request (e.g. multiple model repositories.)
     connect(&network_, &Network::error, this, [&](QString err, QVariant data) {
-        if (data.canConvert<Request>())
+        if (data.canConvert<DownloadRequest>())
+            writeError(data.value<DownloadRequest>(), std::move(err));
+        else if (data.canConvert<Request>())
             writeError(data.value<Request>(), std::move(err));
         else 
             qDebug() << "Network error without request data:" << err;
     });
 
-    connect(&network_, &Network::downloadComplete, this, [this](QFile *file, QString filename, QVariant data) {
+    connect(&network_, &Network::streamComplete, this, [this](QIODevice *download, QString filename, QVariant data) {
         ABORT_UNLESS(data.canConvert<DownloadRequest>(), "Model download completed without DownloadRequest data");
-        auto model = models_.writeModel(file, ModelMeta{}, filename); // TODO get modelmeta from data
-        if (model) {
-            DownloadRequest request = data.value<DownloadRequest>();
-            writeResponse(request, model->toJson());
-        }
+        models_.installModel(download, ModelMeta{}, filename, data); // TODO get modelmeta from data
+    });
+
+    // Installing happens off the main thread, so other requests carry on in
+    // the meantime.
+    connect(&models_, &ModelManager::modelInstalled, this, [this](Model model, QVariant data) {
+        if (data.canConvert<DownloadRequest>())
+            writeResponse(data.value<DownloadRequest>(), model.toJson());
+    });
+
+    connect(&models_, &ModelManager::installFailed, this, [this](QString err, QVariant data) {
+        if (data.canConvert<DownloadRequest>())
+            writeError(data.value<DownloadRequest>(), std::move(err));
     });
 
     // Model manager errors are not always 1-on-1 mappable to requests. For now
@@ -117,7 +462,45 @@ NativeMsgIface::NativeMsgIface(QObject * parent) :
         qDebug() << "Error from model manager:" << err;
     });
 
+    // A new or updated model can change which model a language pair
+    // resolves to, and thereby the translation.
+    connect(&models_, &ModelManager::localModelsChanged, this, [this]() {
+        responseCache_.clear();
+    });
+
     connect(this, &NativeMsgIface::emitJson, this, &NativeMsgIface::processJson);
+    connect(this, &NativeMsgIface::inputClosed, this, &NativeMsgIface::closeInput);
+    connect(this, &NativeMsgIface::inputReleased, this, &NativeMsgIface::readChannels);
+    connect(this, &NativeMsgIface::channelOutput, this, &NativeMsgIface::writeChannel, Qt::QueuedConnection);
+    connect(this, &NativeMsgIface::modelLoaded, this, &NativeMsgIface::processLoadedModels);
+
+    // So routes between languages (see ModelManager::getRoute()) go by how
+    // fast models actually are on this machine.
+    connect(this, &NativeMsgIface::translated, this, [this](QString modelID, int words, double seconds) {
+        if (auto model = models_.getModel(modelID))
+            models_.recordSpeed(*model, words, seconds);
+    }, Qt::QueuedConnection);
+
+    // Keep models that have work queued for them. Queued work holds on to its
+    // model anyway, so evicting it would only lead to loading it twice.
+    modelCache_.setDemand([this](QString const &id) {
+        return scheduler_.demand(id.toStdString());
+    });
+
+    for (unsigned int i = 0; i < std::max(settings_.modelLoadThreads(), 1u); ++i)
+        loaders_.emplace_back(&NativeMsgIface::runLoader, this);
+
+    scheduler_.setWaitObserver([this](TranslationJob::Clock::duration waited) {
+        stats_.queueWait.record(waited);
+    });
+
+    // Optionally keep a recent copy of the stats on disk, for diagnosing
+    // latency problems on machines where we can't send a Stats request.
+    if (!settings_.statsFile().isEmpty()) {
+        QTimer *timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, this, &NativeMsgIface::dumpStats);
+        timer->start(kStatsDumpInterval);
+    }
 }
 
 void NativeMsgIface::run() {
@@ -143,6 +526,10 @@ void NativeMsgIface::run() {
                 break;
             }
 
+            // Don't take on more than we can hold. While we wait here the
+            // pipe fills up and the browser has to wait too.
+            admitInput(ilen);
+
             //  Read in the message into Json
             QByteArray input(ilen, 0);
             if (!std::cin.read(input.data(), ilen)) {
@@ -154,7 +541,7 @@ void NativeMsgIface::run() {
             // all finish before we shut down the main thread.
             operations_++;
 
-            emit emitJson(input);
+            emit emitJson(input, kStdioChannel);
         }
 
         // Here we lock the reading thread until all work is completed because
@@ -162,45 +549,511 @@ void NativeMsgIface::run() {
         // convoluted at the moment.
         std::unique_lock<std::mutex> lck(pendingOpsMutex_);
         pendingOpsCV_.wait(lck, [this](){ return operations_ == 0; });
-        emit finished();
+        emit inputClosed();
     });
 }
 
+bool NativeMsgIface::listen(QString const &name) {
+    server_ = new QLocalServer(this);
+    server_->setSocketOptions(QLocalServer::UserAccessOption);
+
+    // The caller found nobody listening. Either a socket with this name is
+    // left behind by a host that didn't shut down cleanly, or another
+    // browser's host started listening since. Only the former may go.
+    if (!server_->listen(name)) {
+        QLocalSocket probe;
+        probe.connectToServer(name);
+        if (probe.waitForConnected(kRelayConnectTimeout)) {
+            qDebug() << "Another host is listening on" << name;
+            return false;
+        }
+
+        QLocalServer::removeServer(name);
+        if (!server_->listen(name)) {
+            qDebug() << "Could not listen on" << name << ":" << server_->errorString();
+            return false;
+        }
+    }
+
+    connect(server_, &QLocalServer::newConnection, this, &NativeMsgIface::acceptConnections);
+    return true;
+}
+
+void NativeMsgIface::acceptConnections() {
+    while (QLocalSocket *socket = server_->nextPendingConnection()) {
+        int channel = openChannel([socket](QByteArray const &message, bool) {
+            quint32 size = static_cast<quint32>(message.size());
+            socket->write(reinterpret_cast<char const *>(&size), sizeof(size));
+            socket->write(message);
+        });
+        channels_[channel].socket = socket;
+
+        // Only hold on to one message's worth of input. The rest stays in
+        // the relay, which stops reading from its browser when it can't
+        // write to us.
+        socket->setReadBufferSize(kMaxInputLength + sizeof(quint32));
+
+        connect(socket, &QLocalSocket::readyRead, this, [this, channel]() {
+            readChannel(channel);
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, channel]() {
+            closeChannel(channel);
+        });
+    }
+}
+
+int NativeMsgIface::openChannel(std::function<void(QByteArray const &message, bool final)> write) {
+    int channel = nextChannel_++;
+    channels_.insert(channel, Channel{std::move(write)});
+    return channel;
+}
+
+bool NativeMsgIface::submit(int channel, QByteArray const &message) {
+    auto it = channels_.find(channel);
+    assert(it != channels_.end());
+
+    if (!tryAdmitInput(message.size()))
+        return false;
+
+    operations_++;
+    it.value().pending++;
+    processJson(message, channel);
+    return true;
+}
+
+void NativeMsgIface::readChannel(int channel) {
+    auto it = channels_.find(channel);
+    if (it == channels_.end() || !it.value().socket || it.value().closing)
+        return;
+
+    QLocalSocket *socket = it.value().socket;
+
+    for (;;) {
+        quint32 ilen;
+        if (socket->peek(reinterpret_cast<char *>(&ilen), sizeof(ilen)) < qint64(sizeof(ilen)))
+            return;
+
+        // An empty message is how a relay says its input is closed. We hang
+        // up once all of its requests are answered.
+        if (ilen == 0) {
+            socket->read(sizeof(ilen));
+            it.value().closing = true;
+            if (it.value().pending == 0)
+                socket->disconnectFromServer();
+            return;
+        }
+
+        if (ilen >= kMaxInputLength || ilen < 2) {
+            qDebug() << "Invalid message size on channel" << channel << ". Dropping the connection.";
+            socket->abort();
+            return;
+        }
+
+        if (socket->bytesAvailable() < qint64(sizeof(ilen) + ilen))
+            return;
+
+        // Leave it in the socket until there is room. readChannels() comes
+        // back for it.
+        if (!tryAdmitInput(ilen))
+            return;
+
+        socket->read(sizeof(ilen));
+        QByteArray input = socket->read(ilen);
+
+        operations_++;
+        it.value().pending++;
+        processJson(input, channel);
+
+        // Don't trust the iterator after handling a request.
+        it = channels_.find(channel);
+        if (it == channels_.end() || it.value().closing)
+            return;
+    }
+}
+
+void NativeMsgIface::readChannels() {
+    for (int channel : channels_.keys())
+        readChannel(channel);
+}
+
+void NativeMsgIface::closeChannel(int channel) {
+    auto it = channels_.find(channel);
+    if (it == channels_.end())
+        return;
+
+    if (it.value().socket)
+        it.value().socket->deleteLater();
+    channels_.erase(it);
+
+    // Nobody is listening for the answers anymore. Drop the queued work of
+    // the channel's translation requests.
+    QList<std::function<bool(QString)>> aborts;
+    {
+        std::lock_guard<std::mutex> lock(abortMutex_);
+        for (auto handler = abortHandlers_.begin(); handler != abortHandlers_.end(); ++handler)
+            if ((handler.key() >> 32) == channel)
+                aborts.append(handler.value());
+    }
+
+    for (auto &&abort : aborts)
+        abort("Client disconnected");
+
+    if (inputClosed_ && channels_.isEmpty())
+        emit finished();
+}
+
+void NativeMsgIface::writeChannel(int channel, QByteArray message, bool final) {
+    auto it = channels_.find(channel);
+    if (it == channels_.end())
+        return; // Client is gone
+
+    if (final)
+        it.value().pending--;
+
+    QLocalSocket *socket = it.value().socket;
+    bool hangUp = socket && it.value().closing && it.value().pending == 0;
+
+    // A copy, because the writer may submit or close, and thereby change
+    // channels_ while it runs.
+    auto write = it.value().write;
+    write(message, final);
+
+    if (hangUp)
+        socket->disconnectFromServer();
+}
+
+void NativeMsgIface::closeInput() {
+    inputClosed_ = true;
+    if (channels_.isEmpty())
+        emit finished();
+}
+
 void NativeMsgIface::handleRequest(TranslationRequest request) {
     // Initialise models based on the request.
     if (!findModels(request))
         return writeError(request, "Could not find the necessary translation models.");
 
-    if (!loadModels(request))
-        return writeError(request, "Failed to load the necessary translation models.");
+    // Repeated requests (e.g. the same page element) are answered straight
+    // from the response cache. Keyed on the models the languages resolve to
+    // now, as measured speeds can change the route between them.
+    QByteArray cached = responseCache_.get(flightKey(request));
+    if (!cached.isNull()) {
+        stats_.responseCacheHits++;
+        return writeSerializedResponse(request, cached);
+    }
+
+    if (!admitWords(request, request.text.countWords()))
+        return;
+
+    // Loading a model can take a while. The request waits for it here while
+    // other requests keep being handled. Shared so the text isn't copied.
+    auto parked = std::make_shared<TranslationRequest>(std::move(request));
+    auto received = std::chrono::steady_clock::now();
+
+    // While it waits, Cancel, the deadline or the client going away answer
+    // the request, and the continuation below does nothing once the model
+    // is there. translateRequest() takes over from here.
+    auto waiting = std::make_shared<std::atomic<bool>>(true);
+    std::function<bool(QString)> abort = [this, parked, waiting](QString error) {
+        if (!waiting->exchange(false))
+            return false;
+        untrackRequest(parked->key());
+        parked->text.release(); // Don't hold on to it until the model is loaded
+        writeError(*parked, std::move(error));
+        return true;
+    };
+
+    // See translateRequest()
+    if (!trackRequest(parked->key(), abort))
+        return writeError(*parked, "A request with this id is still in progress");
+
+    if (parked->deadline > 0)
+        expireAfter(parked->key(), parked->deadline, abort);
+
+    // Putting the HTML tags back into the translation goes by alignments.
+    withModels(*parked, parked->alignments || parked->html, [this, parked, received, waiting](std::optional<ModelInstance> instance) {
+        if (!waiting->exchange(false))
+            return; // Already answered
+
+        untrackRequest(parked->key());
 
+        if (!instance)
+            return writeError(*parked, "Failed to load the necessary translation models.");
+
+        if (!remainingDeadline(parked->deadline, received))
+            return writeError(*parked, "Deadline exceeded");
+
+        translateRequest(std::move(*parked), std::move(*instance));
+    });
+}
+
+void NativeMsgIface::translateRequest(TranslationRequest request, ModelInstance instance) {
     // Initialise translator settings options
     marian::bergamot::ResponseOptions options;
     options.HTML = request.html;
-    std::function<void(marian::bergamot::Response&&)> callback = [this,request](marian::bergamot::Response&& val) {
-        QJsonObject data = {
-            {"target", QJsonObject{
-                {"text", QString::fromStdString(std::move(val.target.text))}
-            }}
-        };
-        writeResponse(request, std::move(data));
+    options.qualityScores = request.quality;
+    options.alignment = request.alignments || request.html;
+
+    std::size_t cost = std::max<std::size_t>(request.text.countWords(), 1);
+
+    // Identical requests that are still being translated share one flight.
+    QString key = flightKey(request);
+
+    // Take the text out of the request before the request is copied into the
+    // callbacks below; it goes to bergamot as-is, no re-encoding.
+    std::string text = request.text.release();
+
+    // Whoever flips this first answers the request: the flight landing, a
+    // Cancel request or the deadline.
+    auto finished = std::make_shared<std::atomic<bool>>(false);
+
+    std::function<bool(QString)> abort = [this, request, finished, key](QString error) {
+        if (finished->exchange(true))
+            return false;
+        leaveFlight(key, request.key());
+        untrackRequest(request.key());
+        writeError(request, std::move(error));
+        return true;
     };
 
-    // Attempt translation. Beware of runtime errors
-    try {
-        std::visit(overloaded {
-            [&](DirectModelInstance &model) {
-                service_->translate(model.model, std::move(request.text.toStdString()), callback, options);
-            },
-            [&](PivotModelInstance &model) {
-                service_->pivot(model.model, model.pivot, std::move(request.text.toStdString()), callback, options);
+    std::function<void(QByteArray const &)> deliver = [this, request, finished](QByteArray const &data) {
+        if (finished->exchange(true))
+            return; // Cancelled or expired in the meantime
+
+        untrackRequest(request.key());
+        writeSerializedResponse(request, data);
+    };
+
+    // Another request with this id is still waiting for its answer. Its
+    // flight, Cancel and the client can't tell the two apart.
+    if (!trackRequest(request.key(), abort))
+        return writeError(request, "A request with this id is still in progress");
+
+    if (request.deadline > 0)
+        expireAfter(request.key(), request.deadline, abort);
+
+    // If the same text is already on its way, just wait for that one.
+    std::optional<qint64> jobID = joinFlight(key, request.key(), Waiter{deliver, abort});
+    if (!jobID)
+        return;
+
+    std::function<void(marian::bergamot::Response&&)> callback = [this, key, cost, quality = request.quality, alignments = request.alignments](marian::bergamot::Response&& val) {
+        // Free up the capacity first so the next job can start.
+        scheduler_.done(cost);
+
+        // Serialized once for every waiter and the response cache.
+        QJsonObject data{{"target", targetToJson(std::move(val), quality, alignments)}};
+        auto start = std::chrono::steady_clock::now();
+        QByteArray serialized = QJsonDocument(data).toJson(QJsonDocument::Compact);
+        stats_.serialize.record(std::chrono::steady_clock::now() - start);
+
+        responseCache_.insert(key, serialized);
+
+        for (auto &&waiter : landFlight(key))
+            waiter.deliver(serialized);
+    };
+
+    // No deadline on the job itself: it serves every request in the flight,
+    // and is dropped when the last of them leaves (see leaveFlight()).
+    TranslationJob job;
+    job.requestID = *jobID;
+    job.session = request.session.toStdString();
+    job.models = modelIDs(instance);
+    job.priority = request.priority;
+    job.cost = cost;
+    job.submit = [this, instance = std::move(instance), text = std::move(text), callback, options, key, cost]() mutable {
+        // Attempt translation. Beware of runtime errors
+        try {
+            translate(instance, std::move(text), cost, callback, options);
+        } catch (const std::runtime_error &e) {
+            scheduler_.done(cost);
+            for (auto &&waiter : landFlight(key))
+                waiter.abort(QString::fromStdString(e.what()));
+        }
+    };
+
+    scheduler_.push(std::move(job));
+}
+
+void NativeMsgIface::handleRequest(TranslationBatchRequest request) {
+    std::size_t words = 0;
+    for (auto &&item : request.texts)
+        words += item.text.countWords();
+
+    if (!admitWords(request, words))
+        return;
+
+    if (!findModels(request))
+        return writeError(request, "Could not find the necessary translation models.");
+
+    // See handleRequest(TranslationRequest)
+    auto parked = std::make_shared<TranslationBatchRequest>(std::move(request));
+    auto received = std::chrono::steady_clock::now();
+
+    auto waiting = std::make_shared<std::atomic<bool>>(true);
+    std::function<bool(QString)> abort = [this, parked, waiting](QString error) {
+        if (!waiting->exchange(false))
+            return false;
+        untrackRequest(parked->key());
+        parked->texts.clear();
+        writeError(*parked, std::move(error));
+        return true;
+    };
+
+    if (!trackRequest(parked->key(), abort))
+        return writeError(*parked, "A request with this id is still in progress");
+
+    if (parked->deadline > 0)
+        expireAfter(parked->key(), parked->deadline, abort);
+
+    // Any HTML item needs a model that computes alignments.
+    bool alignment = parked->alignments || std::any_of(parked->texts.begin(), parked->texts.end(), [](TranslationBatchItem const &item) {
+        return item.html;
+    });
+
+    withModels(*parked, alignment, [this, parked, received, waiting](std::optional<ModelInstance> instance) {
+        if (!waiting->exchange(false))
+            return; // Already answered
+
+        untrackRequest(parked->key());
+
+        if (!instance)
+            return writeError(*parked, "Failed to load the necessary translation models.");
+
+        if (!remainingDeadline(parked->deadline, received))
+            return writeError(*parked, "Deadline exceeded");
+
+        translateRequest(std::move(*parked), std::move(*instance));
+    });
+}
+
+void NativeMsgIface::translateRequest(TranslationBatchRequest request, ModelInstance instance) {
+    if (request.texts.isEmpty())
+        return writeResponse(request, QJsonArray());
+
+    // Shared between the callbacks of all items. The last item to finish
+    // writes the response.
+    struct Batch {
+        std::mutex mutex;
+        QVector<QJsonObject> results;
+        int pending;
+        bool finished{false};
+    };
+
+    // Streamed items went out as updates already, so the final response
+    // has none.
+    auto batch = std::make_shared<Batch>();
+    if (!request.stream)
+        batch->results.resize(request.texts.size());
+    batch->pending = request.texts.size();
+
+    // Take the texts out of the request so each callback below doesn't hold
+    // a copy of the entire batch.
+    QVector<TranslationBatchItem> items = std::move(request.texts);
+    request.texts.clear();
+
+    std::function<bool(QString)> abort = [this, request, batch](QString error) {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (batch->finished)
+            return false;
+        batch->finished = true;
+        scheduler_.cancel(request.key()); // Drop whatever is still queued
+        untrackRequest(request.key());
+        writeError(request, std::move(error));
+        return true;
+    };
+
+    // See translateRequest(TranslationRequest)
+    if (!trackRequest(request.key(), abort))
+        return writeError(request, "A request with this id is still in progress");
+
+    if (request.deadline > 0)
+        expireAfter(request.key(), request.deadline, abort);
+
+    std::vector<std::string> models = modelIDs(instance);
+
+    for (int i = 0; i < items.size(); ++i) {
+        marian::bergamot::ResponseOptions options;
+        options.HTML = items[i].html;
+        options.qualityScores = request.quality;
+        options.alignment = request.alignments || items[i].html;
+
+        std::size_t cost = std::max<std::size_t>(items[i].text.countWords(), 1);
+
+        std::function<void(marian::bergamot::Response&&)> callback = [this, request, batch, i, cost, itemID = items[i].id](marian::bergamot::Response&& val) {
+            scheduler_.done(cost);
+
+            QJsonObject item{
+                {"target", targetToJson(std::move(val), request.quality, request.alignments)}
+            };
+
+            if (!itemID.isUndefined())
+                item["id"] = itemID;
+
+            // Holding the batch lock while writing keeps all updates
+            // ahead of the final response.
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            if (batch->finished)
+                return;
+
+            if (request.stream) {
+                QJsonObject update(item);
+                update["index"] = i;
+                writeUpdate(request, std::move(update));
+            } else {
+                batch->results[i] = std::move(item);
             }
-        }, *model_);
-    } catch (const std::runtime_error &e) {
-        writeError(request, QString::fromStdString(std::move(e.what())));
+
+            if (--batch->pending > 0)
+                return;
+
+            batch->finished = true;
+            untrackRequest(request.key());
+            QJsonArray results;
+            for (auto &&result : batch->results)
+                results.append(std::move(result));
+            writeResponse(request, std::move(results));
+        };
+
+        TranslationJob job;
+        job.requestID = request.key();
+        job.session = request.session.toStdString();
+        job.models = models;
+        job.priority = request.priority;
+        job.cost = cost;
+        if (request.deadline > 0)
+            job.deadline = TranslationJob::Clock::now() + std::chrono::milliseconds(request.deadline);
+        job.submit = [this, instance, text = items[i].text.release(), callback, options, abort, cost]() mutable {
+            try {
+                translate(instance, std::move(text), cost, callback, options);
+            } catch (const std::runtime_error &e) {
+                scheduler_.done(cost);
+                abort(QString::fromStdString(e.what()));
+            }
+        };
+        job.expired = [abort]() {
+            abort("Deadline exceeded");
+        };
+
+        scheduler_.push(std::move(job));
     }
 }
 
+void NativeMsgIface::handleRequest(CancelRequest request) {
+    std::function<bool(QString)> abort;
+    {
+        std::lock_guard<std::mutex> lock(abortMutex_);
+        abort = abortHandlers_.value(Request::key(request.channel, request.requestID));
+    }
+
+    // The abort handler drops whatever is still queued and answers the
+    // cancelled request. Work that is already in the service runs to
+    // completion but is discarded.
+    bool cancelled = abort && abort("Request was cancelled");
+
+    writeResponse(request, QJsonObject{{"cancelled", cancelled}});
+}
+
 void NativeMsgIface::handleRequest(ListRequest request)  {
     // Fetch remote models if necessary.
     if (request.includeRemote && models_.getRemoteModels().isEmpty()) {
@@ -264,17 +1117,17 @@ void NativeMsgIface::handleRequest(DownloadRequest request)  {
         return writeResponse(request, response);
     }
 
-    // Download new model
-    QNetworkReply *reply = network_.downloadFile(model->url, QCryptographicHash::Sha256, model->checksum, QVariant::fromValue(request));
+    // Download and extract new model
+    SegmentedDownload *download = models_.downloadModel(&network_, *model, QVariant::fromValue(request));
 
-    // downloadFile can return nullptr if it can't open the temp file. In
+    // downloadModel can return nullptr if it can't create the temp dir. In
     // that case it will also emit an Network::error(QString) signal which
     // we already handle above.
-    if (!reply)
+    if (!download)
         return;
 
     // Pass any download progress updates along to the client.
-    connect(reply, &QNetworkReply::downloadProgress, this, [=](qint64 ist, qint64 max) {
+    connect(download, &SegmentedDownload::downloadProgress, this, [=](qint64 ist, qint64 max) {
          QJsonObject update {
             {"read", ist},
             {"size", max},
@@ -284,7 +1137,95 @@ void NativeMsgIface::handleRequest(DownloadRequest request)  {
         writeUpdate(request, update);
     });
 
-    // Network::downloadComplete() or Network::error() will trigger the writeResponse or writeError for this request.
+    // Network::streamComplete() or Network::error() will trigger the writeResponse or writeError for this request.
+}
+
+void NativeMsgIface::handleRequest(LoadModelRequest request) {
+    if (!findModels(request))
+        return writeError(request, "Could not find the necessary translation models.");
+
+    for (auto &&id : {request.model, request.pivot}) {
+        if (id.isEmpty())
+            continue;
+        
+        auto model = models_.getModel(id);
+        if (model && model->isLocal() && !cachedModel(*model, request.alignments))
+            writeUpdate(request, QJsonObject{{"loading", id}});
+    }
+
+    withModels(request, request.alignments, [this, request](std::optional<ModelInstance> instance) {
+        if (!instance)
+            return writeError(request, "Failed to load the necessary translation models.");
+
+        QJsonArray models;
+        for (auto &&id : modelIDs(*instance))
+            models.append(QString::fromStdString(id));
+        writeResponse(request, QJsonObject{{"models", models}});
+    });
+}
+
+void NativeMsgIface::handleRequest(UnloadModelRequest request) {
+    if (!findModels(request))
+        return writeError(request, "Could not find the necessary translation models.");
+
+    QJsonArray unloaded;
+    for (auto &&id : {request.model, request.pivot}) {
+        if (id.isEmpty())
+            continue;
+        
+        alignmentModels_.remove(id);
+        if (modelCache_.remove(id))
+            unloaded.append(id);
+    }
+
+    writeResponse(request, QJsonObject{{"unloaded", unloaded}});
+}
+
+void NativeMsgIface::handleRequest(StatsRequest request) {
+    writeResponse(request, statsJson());
+}
+
+QJsonObject NativeMsgIface::statsJson() const {
+    QJsonObject stats = stats_.toJson();
+
+    stats["operations"] = operations_.load();
+    stats["channels"] = channels_.size();
+    stats["queued"] = static_cast<qint64>(scheduler_.queued());
+    stats["queued_words"] = static_cast<qint64>(scheduler_.queuedCost());
+
+    QJsonObject sessions;
+    for (auto &&session : scheduler_.queuedPerSession())
+        sessions[QString::fromStdString(session.first)] = static_cast<qint64>(session.second);
+    stats["sessions"] = sessions;
+
+    QJsonArray models;
+    for (auto &&entry : modelCache_.contents()) {
+        models.append(QJsonObject{
+            {"id", entry.first},
+            {"size", static_cast<qint64>(entry.second)},
+            {"load_ms", loadTimes_.value(entry.first, -1)}
+        });
+    }
+
+    stats["model_cache"] = QJsonObject{
+        {"budget", static_cast<qint64>(modelCache_.budget())},
+        {"used", static_cast<qint64>(modelCache_.used())},
+        {"models", models},
+        {"loading", loading_.size()}
+    };
+
+    return stats;
+}
+
+void NativeMsgIface::dumpStats() const {
+    QSaveFile file(settings_.statsFile());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Could not write stats to" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+
+    file.write(QJsonDocument(statsJson()).toJson());
+    file.commit();
 }
 
 void NativeMsgIface::handleRequest(MalformedRequest request)  {
@@ -292,12 +1233,15 @@ void NativeMsgIface::handleRequest(MalformedRequest request)  {
 }
 
 request_variant NativeMsgIface::parseJsonInput(QByteArray input) {
+    if (auto request = parseTranslationRequest(input))
+        return std::move(*request);
+
     QJsonDocument inputJson = QJsonDocument::fromJson(input);
     QJsonObject jsonObj = inputJson.object();
 
     // Define what are mandatory and what are optional request keys
     static const QStringList mandatoryKeys({"command", "id", "data"}); // Expected in every message
-    static const QSet<QString> commandTypes({"ListModels", "DownloadModel", "Translate"});
+    static const QSet<QString> commandTypes({"ListModels", "DownloadModel", "Translate", "TranslateBatch", "Cancel", "LoadModel", "UnloadModel", "Stats"});
     // Json doesn't have schema validation, so validate here, in place:
     QString command;
     int id;
@@ -305,24 +1249,24 @@ request_variant NativeMsgIface::parseJsonInput(QByteArray input) {
     {
         QJsonValueRef idVariant = jsonObj["id"];
         if (idVariant.isNull()) {
-            return MalformedRequest{-1, "ID field in message cannot be null!"};
+            return MalformedRequest{{-1}, "ID field in message cannot be null!"};
         } else {
             id = idVariant.toInt();
         }
 
         QJsonValueRef commandVariant = jsonObj["command"];
         if (commandVariant.isNull()) {
-            return MalformedRequest{id, "command field in message cannot be null!"};
+            return MalformedRequest{{id}, "command field in message cannot be null!"};
         } else {
             command = commandVariant.toString();
             if (commandTypes.find(command) == commandTypes.end()) {
-                return MalformedRequest{id, QString("Unrecognised message command: %1 AvailableCommands: %2").arg(command).arg(join(" ", commandTypes))};
+                return MalformedRequest{{id}, QString("Unrecognised message command: %1 AvailableCommands: %2").arg(command).arg(join(" ", commandTypes))};
             }
         }
 
         QJsonValueRef dataVariant = jsonObj["data"];
         if (dataVariant.isNull()) {
-            return MalformedRequest{id, "data field in message cannot be null!"};
+            return MalformedRequest{{id}, "data field in message cannot be null!"};
         } else {
             data = dataVariant.toObject();
         }
@@ -332,13 +1276,13 @@ request_variant NativeMsgIface::parseJsonInput(QByteArray input) {
     if (command == "Translate") {
         // Keys expected in a translation request
         static const QStringList mandatoryKeysTranslate({"text"});
-        static const QStringList optionalKeysTranslate({"html", "quality", "alignments", "src", "trg", "model", "pivot"});
+        static const QStringList optionalKeysTranslate({"html", "quality", "alignments", "src", "trg", "prefer", "model", "pivot", "priority", "deadline", "session"});
         TranslationRequest ret;
         ret.set("id", id);
         for (auto&& key : mandatoryKeysTranslate) {
             QJsonValueRef val = data[key];
             if (val.isNull()) {
-                return MalformedRequest{id, QString("data field key %1 cannot be null!").arg(key)};
+                return MalformedRequest{{id}, QString("data field key %1 cannot be null!").arg(key)};
             } else {
                 ret.set(key, val);
             }
@@ -350,9 +1294,79 @@ request_variant NativeMsgIface::parseJsonInput(QByteArray input) {
             }
         }
         if ((!ret.src.isEmpty() && !ret.trg.isEmpty()) == (!ret.model.isEmpty())) {
-            return MalformedRequest{id, QString("either the data fields src and trg, or the field model has to be specified")};
+            return MalformedRequest{{id}, QString("either the data fields src and trg, or the field model has to be specified")};
         }
         return ret;
+    } else if (command == "TranslateBatch") {
+        TranslationBatchRequest ret;
+        ret.id = id;
+        ret.src = data.value("src").toString();
+        ret.trg = data.value("trg").toString();
+        ret.model = data.value("model").toString();
+        ret.pivot = data.value("pivot").toString();
+        ret.setPolicy(data.value("prefer").toString());
+        ret.stream = data.value("stream").toBool();
+        ret.quality = data.value("quality").toBool();
+        ret.alignments = data.value("alignments").toBool();
+        ret.priority = data.value("priority").toInt();
+        ret.deadline = data.value("deadline").toInt();
+        ret.session = data.value("session").toString();
+        if ((!ret.src.isEmpty() && !ret.trg.isEmpty()) == (!ret.model.isEmpty())) {
+            return MalformedRequest{{id}, QString("either the data fields src and trg, or the field model has to be specified")};
+        }
+
+        QJsonValue texts = data.value("texts");
+        if (!texts.isArray()) {
+            return MalformedRequest{{id}, QString("data field key texts has to be an array!")};
+        }
+
+        QJsonArray const items = texts.toArray();
+        ret.texts.reserve(items.size());
+        for (QJsonValue value : items) {
+            QJsonObject item = value.toObject();
+            QJsonValue text = item.value("text");
+            if (!text.isString()) {
+                return MalformedRequest{{id}, QString("item %1 of data field texts has no text!").arg(ret.texts.size())};
+            }
+            ret.texts.append(TranslationBatchItem{Utf8String::fromQString(text.toString()), item.value("html").toBool(), item.value("id")});
+        }
+        return ret;
+    } else if (command == "Cancel") {
+        QJsonValue requestID = data.value("requestID");
+        if (!requestID.isDouble()) {
+            return MalformedRequest{{id}, QString("data field key requestID has to be a number!")};
+        }
+        CancelRequest ret;
+        ret.id = id;
+        ret.requestID = requestID.toInt();
+        return ret;
+    } else if (command == "LoadModel" || command == "UnloadModel") {
+        ModelSelection selection;
+        selection.src = data.value("src").toString();
+        selection.trg = data.value("trg").toString();
+        selection.model = data.value("model").toString();
+        selection.pivot = data.value("pivot").toString();
+        selection.setPolicy(data.value("prefer").toString());
+        if ((!selection.src.isEmpty() && !selection.trg.isEmpty()) == (!selection.model.isEmpty())) {
+            return MalformedRequest{{id}, QString("either the data fields src and trg, or the field model has to be specified")};
+        }
+
+        if (command == "LoadModel") {
+            LoadModelRequest ret;
+            ret.id = id;
+            static_cast<ModelSelection &>(ret) = selection;
+            ret.alignments = data.value("alignments").toBool();
+            return ret;
+        } else {
+            UnloadModelRequest ret;
+            ret.id = id;
+            static_cast<ModelSelection &>(ret) = selection;
+            return ret;
+        }
+    } else if (command == "Stats") {
+        StatsRequest ret;
+        ret.id = id;
+        return ret;
     } else if (command == "ListModels") {
         // Keys expected in a list requested
         static const QStringList optionalKeysList({"includeRemote"});
@@ -373,34 +1387,72 @@ request_variant NativeMsgIface::parseJsonInput(QByteArray input) {
         for (auto&& key : mandatoryKeysDownload) {
             QJsonValueRef val = data[key];
             if (val.isNull()) {
-                return MalformedRequest{id, QString("data field key %1 cannot be null!").arg(key)};
+                return MalformedRequest{{id}, QString("data field key %1 cannot be null!").arg(key)};
             } else {
                 ret.modelID = val.toString();
             }
         }
         return ret;
     } else {
-        return MalformedRequest{id, QString("Developer error. We shouldn't ever be here! Command: %1").arg(command)};
+        return MalformedRequest{{id}, QString("Developer error. We shouldn't ever be here! Command: %1").arg(command)};
     }
 
-    return MalformedRequest{id, QString("Developer error. We shouldn't ever be here! This makes the compiler happy though.")};
+    return MalformedRequest{{id}, QString("Developer error. We shouldn't ever be here! This makes the compiler happy though.")};
+
+}
+
+void NativeMsgIface::writeJsonHelper(Request const &request, QJsonDocument&& document, bool final) {
+    auto start = std::chrono::steady_clock::now();
+    QByteArray message = document.toJson(QJsonDocument::Compact);
+    stats_.serialize.record(std::chrono::steady_clock::now() - start);
+    writeFrame(request.channel, message, final);
+}
+
+void NativeMsgIface::writeFrame(int channel, QByteArray const &message, bool final) {
+    stats_.bytesOut += message.size();
+
+    if (channel == kStdioChannel)
+        return writer_.write(message);
 
+    // Sockets belong to the main thread. Queued even when emitted from the
+    // main thread, so all messages of a channel go out in the order in
+    // which they were written.
+    emit channelOutput(channel, message, final);
 }
 
-void NativeMsgIface::lockAndWriteJsonHelper(QJsonDocument&& document) {
-    QByteArray arr = document.toJson();
-    std::lock_guard<std::mutex> lock(coutmutex_);
-    size_t outputSize = arr.size();
-    std::cout.write(reinterpret_cast<char*>(&outputSize), 4);
-    std::cout.write(arr.data(), outputSize);
-    std::cout.flush();
+void NativeMsgIface::writeSerializedResponse(Request const &request, QByteArray const &data) {
+    // See writeResponse()
+    operations_--;
+    pendingOpsCV_.notify_one();
+    releaseInput(request);
+
+    // Same fields as writeResponse(), minus the detour through QJsonDocument.
+    QByteArray message;
+    message.reserve(data.size() + 48);
+    message.append("{\"data\":");
+    message.append(data);
+    message.append(",\"id\":");
+    message.append(QByteArray::number(request.id));
+    message.append(",\"success\":true}");
+
+    writeFrame(request.channel, message, true);
 }
 
-// Fills in the TranslationRequest.{model,pivot} parameters if src + trg are specified.
-bool NativeMsgIface::findModels(TranslationRequest &request) const {
+// Fills in the ModelSelection.{model,pivot} parameters if src + trg are specified.
+bool NativeMsgIface::findModels(ModelSelection &request) const {
     if (!request.model.isEmpty())
         return true;
 
+    // Installed models, directly or through whichever pivot works out best.
+    if (std::optional<ModelRoute> route = models_.getRoute(request.src, request.trg, request.policy)) {
+        request.model = route->model.id();
+        if (route->pivot)
+            request.pivot = route->pivot->id();
+        return true;
+    }
+
+    // Nothing installed will do. These also find models that still have to be
+    // downloaded, so the error is about that instead.
     if (std::optional<Model> directModel = models_.getModelForLanguagePair(request.src, request.trg)) {
         request.model = directModel->id();
         return true;
@@ -415,51 +1467,368 @@ bool NativeMsgIface::findModels(TranslationRequest &request) const {
     return false;
 }
 
-bool NativeMsgIface::loadModels(TranslationRequest const &request) {
-    // First, check if we have everything required already loaded:
-    if (model_ && std::visit(overloaded {
-        [&](DirectModelInstance const &instance) { return instance.modelID == request.model && request.pivot.isEmpty(); },
-        [&](PivotModelInstance const &instance) { return instance.modelID == request.model && instance.pivotID == request.pivot; }
-    }, *model_))
-        return true;
+void NativeMsgIface::withModels(ModelSelection const &request, bool alignment, std::function<void(std::optional<ModelInstance>)> then, QHash<QString, ModelPtr> held) {
+    QList<Model> models;
+    for (auto &&id : {request.model, request.pivot}) {
+        if (id.isEmpty())
+            continue;
 
-    if (!request.model.isEmpty() && !request.pivot.isEmpty()) {
-        auto model = models_.getModel(request.model);
-        auto pivot = models_.getModel(request.pivot);
+        auto model = models_.getModel(id);
+        if (!model || !model->isLocal())
+            return then(std::nullopt);
+        
+        models.append(*model);
+    }
 
-        if (!model || !pivot || !model->isLocal() || !pivot->isLocal())
-            return false;
+    if (models.isEmpty())
+        return then(std::nullopt); // Should not happen, because we called findModels first, right?
 
-        model_ = PivotModelInstance{model->id(), pivot->id(), makeModel(*model), makeModel(*pivot)};
-        return true;
-    } else if (!request.model.isEmpty()) {
-        auto model = models_.getModel(request.model);
-        if (!model || !model->isLocal())
-            return false;
+    for (auto &&model : models) {
+        if (held.contains(model.id()))
+            continue;
         
-        model_ = DirectModelInstance{model->id(), makeModel(*model)};
-        return true;
+        if (auto cached = cachedModel(model, alignment)) {
+            stats_.modelCacheHits++;
+            held.insert(model.id(), cached);
+            continue;
+        }
+
+        stats_.modelCacheMisses++;
+
+        // Not loaded yet. Come back once it is, holding on to it so it can't
+        // be evicted again while the other (pivot) model is loading.
+        return loadModel(model, alignment, [this, request, alignment, then, held, id = model.id()](ModelPtr loaded) mutable {
+            if (!loaded)
+                return then(std::nullopt);
+
+            held.insert(id, loaded);
+            withModels(request, alignment, then, held);
+        });
     }
 
-    return false; // Should not happen, because we called findModels first, right?
+    // Pivot instances share the cached direct models.
+    if (models.size() == 2)
+        then(PivotModelInstance{models[0].id(), models[1].id(), held[models[0].id()], held[models[1].id()]});
+    else
+        then(DirectModelInstance{models[0].id(), held[models[0].id()]});
 }
 
-std::shared_ptr<marian::bergamot::TranslationModel> NativeMsgIface::makeModel(Model const &model) {
-    // TODO: Maybe cache these shared ptrs? With a weakptr? They might still be around in the
-    // translation queue even when we switched. No need to load them again.
+QString NativeMsgIface::loadKey(Model const &model, bool alignment) const {
+    return alignment ? model.id() + kAlignmentSuffix : model.id();
+}
+
+NativeMsgIface::ModelPtr NativeMsgIface::cachedModel(Model const &model, bool alignment) {
+    // The cache holds one instance of every model. One that computes
+    // alignments also serves requests without them, just not the other way
+    // around.
+    if (alignment && !alignmentModels_.contains(model.id()))
+        return nullptr;
+
+    return modelCache_.get(model.id());
+}
+
+void NativeMsgIface::loadModel(Model const &model, bool alignment, std::function<void(ModelPtr)> then) {
+    QString key = loadKey(model, alignment);
+
+    // Someone else is already waiting for this model, or for one that
+    // computes alignments, which will do just as well.
+    auto it = loading_.find(key);
+    if (it == loading_.end() && !alignment)
+        it = loading_.find(loadKey(model, true));
+
+    if (it != loading_.end()) {
+        it.value().append(std::move(then));
+        return;
+    }
+
+    loading_.insert(key, {std::move(then)});
+
+    LoadJob job;
+    job.key = key;
+    job.model = model;
+    job.alignment = alignment;
+    job.settings = settings_.marianSettings();
+
+    std::lock_guard<std::mutex> lock(loaderMutex_);
+    loadQueue_.push_back(std::move(job));
+    loaderCV_.notify_one();
+}
+
+void NativeMsgIface::runLoader() {
+    for (;;) {
+        LoadJob job;
+        {
+            std::unique_lock<std::mutex> lock(loaderMutex_);
+            loaderCV_.wait(lock, [this]() { return !loadQueue_.empty() || loaderShutdown_; });
+            if (loaderShutdown_)
+                break;
+            job = std::move(loadQueue_.front());
+            loadQueue_.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        try {
+            job.loaded = makeModel(job.model, job.alignment, job.settings);
+            job.size = ModelCache::measureModel(job.model.path);
+            job.loadTime = std::chrono::steady_clock::now() - start;
+            stats_.modelLoad.record(job.loadTime);
+        } catch (const std::exception &e) {
+            stats_.modelLoadFailures++;
+            std::cerr << "Failed to load model " << job.model.id().toStdString() << ": " << e.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loaderMutex_);
+            loadedQueue_.push_back(std::move(job));
+        }
+
+        // Picked up by processLoadedModels() on the main thread.
+        emit modelLoaded();
+    }
+}
+
+void NativeMsgIface::processLoadedModels() {
+    std::deque<LoadJob> loaded;
+    {
+        std::lock_guard<std::mutex> lock(loaderMutex_);
+        std::swap(loaded, loadedQueue_);
+    }
+
+    for (auto &&job : loaded) {
+        QString id = job.model.id();
+
+        // An instance that computes alignments replaces one that doesn't, but
+        // not the other way around, e.g. when both were loading at once.
+        if (job.loaded && (job.alignment || !(alignmentModels_.contains(id) && modelCache_.contains(id)))) {
+            modelCache_.insert(id, job.loaded, job.size);
+            loadTimes_.insert(id, std::chrono::duration_cast<std::chrono::milliseconds>(job.loadTime).count());
+
+            if (job.alignment)
+                alignmentModels_.insert(id);
+            else
+                alignmentModels_.remove(id);
+        }
+
+        for (auto &&then : loading_.take(job.key))
+            then(job.loaded);
+    }
+}
+
+std::shared_ptr<marian::bergamot::TranslationModel> NativeMsgIface::makeModel(Model const &model, bool alignment, translateLocally::marianSettings const &settings) {
     return std::make_shared<marian::bergamot::TranslationModel>(
-        makeOptions(model.path.toStdString(), settings_.marianSettings()),
-        settings_.marianSettings().cpu_threads
+        makeOptions(model.path.toStdString(), settings, alignment),
+        settings.cpu_threads
     );
 }
 
-void NativeMsgIface::processJson(QByteArray input) {
+bool NativeMsgIface::remainingDeadline(int &deadline, std::chrono::steady_clock::time_point received) const {
+    if (deadline <= 0)
+        return true; // No deadline
+    
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - received).count();
+    if (waited >= deadline)
+        return false;
+
+    deadline -= static_cast<int>(waited);
+    return true;
+}
+
+void NativeMsgIface::translate(ModelInstance &instance, std::string &&text, std::size_t words, std::function<void(marian::bergamot::Response&&)> callback, marian::bergamot::ResponseOptions const &options) {
+    // How fast a model is only shows in translations of some length, and
+    // a pivot translation takes the time of two models together.
+    QString modelID;
+    if (auto direct = std::get_if<DirectModelInstance>(&instance))
+        if (words >= kMinSpeedSampleWords)
+            modelID = direct->modelID;
+
+    if (!modelID.isEmpty())
+        startBusy(modelID);
+
+    auto submitted = std::chrono::steady_clock::now();
+    std::function<void(marian::bergamot::Response&&)> timed = [this, callback, submitted, words, modelID](marian::bergamot::Response&& val) {
+        auto now = std::chrono::steady_clock::now();
+        stats_.translate.record(now - submitted);
+
+        if (!modelID.isEmpty())
+            emit translated(modelID, static_cast<int>(words), endBusy(modelID, now));
+
+        callback(std::move(val));
+    };
+
+    try {
+        std::visit(overloaded {
+            [&](DirectModelInstance &model) {
+                service_->translate(model.model, std::move(text), timed, options);
+            },
+            [&](PivotModelInstance &model) {
+                service_->pivot(model.model, model.pivot, std::move(text), timed, options);
+            }
+        }, instance);
+    } catch (const std::runtime_error &) {
+        if (!modelID.isEmpty())
+            endBusy(modelID, std::chrono::steady_clock::now());
+        throw;
+    }
+}
+
+void NativeMsgIface::startBusy(QString const &modelID) {
+    std::lock_guard<std::mutex> lock(busyMutex_);
+    Busy &busy = busy_[modelID];
+    if (busy.jobs++ == 0)
+        busy.since = std::chrono::steady_clock::now();
+}
+
+double NativeMsgIface::endBusy(QString const &modelID, std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(busyMutex_);
+    auto it = busy_.find(modelID);
+    assert(it != busy_.end());
+
+    // The time since whichever job was done last, as that job's time is
+    // counted up to then already.
+    double seconds = std::chrono::duration<double>(now - it->since).count();
+    it->since = now;
+    if (--it->jobs == 0)
+        busy_.erase(it);
+    return seconds;
+}
+
+bool NativeMsgIface::trackRequest(qint64 key, std::function<bool(QString)> abort) {
+    std::lock_guard<std::mutex> lock(abortMutex_);
+    if (abortHandlers_.contains(key))
+        return false;
+
+    abortHandlers_.insert(key, std::move(abort));
+    return true;
+}
+
+void NativeMsgIface::untrackRequest(qint64 key) {
+    std::lock_guard<std::mutex> lock(abortMutex_);
+    abortHandlers_.remove(key);
+}
+
+void NativeMsgIface::expireAfter([[maybe_unused]] qint64 key, int milliseconds, std::function<bool(QString)> abort) {
+    QTimer::singleShot(milliseconds, this, [abort]() {
+        abort("Deadline exceeded");
+    });
+}
+
+QString NativeMsgIface::flightKey(TranslationRequest const &request) const {
+    // A digest instead of the text itself, so the key doesn't hold on to
+    // another copy of every text being translated. It has to be a
+    // cryptographic one: texts come from web pages, and two that collide
+    // would get each other's translation, also through the response cache.
+    QCryptographicHash digest(QCryptographicHash::Sha256);
+    digest.addData(request.text.str().data(), static_cast<int>(request.text.size()));
+    return request.model + '|' + request.pivot + '|'
+        + (request.html ? 'h' : '-') + (request.quality ? 'q' : '-') + (request.alignments ? 'a' : '-') + '|'
+        + QString::fromLatin1(digest.result().toBase64());
+}
+
+std::optional<qint64> NativeMsgIface::joinFlight(QString const &key, qint64 requestKey, Waiter waiter) {
+    std::lock_guard<std::mutex> lock(flightsMutex_);
+    auto it = flights_.find(key);
+    if (it != flights_.end()) {
+        it.value().waiters.insert(requestKey, std::move(waiter));
+        stats_.coalesced++;
+        return std::nullopt;
+    }
+
+    qint64 jobID = nextFlightJobID_--;
+    Flight flight;
+    flight.jobID = jobID;
+    flight.waiters.insert(requestKey, std::move(waiter));
+    flights_.insert(key, std::move(flight));
+    return jobID;
+}
+
+void NativeMsgIface::leaveFlight(QString const &key, qint64 requestKey) {
+    std::lock_guard<std::mutex> lock(flightsMutex_);
+    auto it = flights_.find(key);
+    if (it == flights_.end() || it.value().waiters.remove(requestKey) == 0)
+        return; // Already landed
+    
+    // Nobody is waiting for this translation anymore. If it hasn't been
+    // handed to the service yet, it never has to be.
+    if (it.value().waiters.isEmpty()) {
+        scheduler_.cancel(it.value().jobID);
+        flights_.erase(it);
+    }
+}
+
+QList<NativeMsgIface::Waiter> NativeMsgIface::landFlight(QString const &key) {
+    std::lock_guard<std::mutex> lock(flightsMutex_);
+    auto it = flights_.find(key);
+    if (it == flights_.end())
+        return {}; // Everyone left
+    
+    QList<Waiter> waiters = it.value().waiters.values();
+    flights_.erase(it);
+    return waiters;
+}
+
+void NativeMsgIface::admitInput(std::size_t size) {
+    std::unique_lock<std::mutex> lock(admissionMutex_);
+    admissionCV_.wait(lock, [&]() {
+        return queuedBytes_ == 0 || queuedBytes_ + size <= maxQueuedBytes_;
+    });
+    queuedBytes_ += size;
+}
+
+bool NativeMsgIface::tryAdmitInput(std::size_t size) {
+    std::lock_guard<std::mutex> lock(admissionMutex_);
+    if (queuedBytes_ == 0 || queuedBytes_ + size <= maxQueuedBytes_) {
+        queuedBytes_ += size;
+        return true;
+    }
+
+    inputStalled_ = true;
+    return false;
+}
+
+void NativeMsgIface::releaseInput(Request const &request) {
+    bool stalled;
+    {
+        std::lock_guard<std::mutex> lock(admissionMutex_);
+        queuedBytes_ -= std::min(queuedBytes_, request.size);
+        stalled = std::exchange(inputStalled_, false);
+    }
+    admissionCV_.notify_one();
+
+    if (stalled)
+        emit inputReleased();
+}
+
+bool NativeMsgIface::admitWords(Request const &request, std::size_t words) {
+    std::size_t queued = scheduler_.queuedCost();
+    if (queued == 0 || queued + words <= maxQueuedWords_)
+        return true;
+
+    writeError(request, "Too much text is waiting to be translated", true);
+    return false;
+}
+
+void NativeMsgIface::processJson(QByteArray input, int channel) {
+    stats_.requests++;
+    stats_.bytesIn += input.size();
+
     auto myJsonInputVariant = parseJsonInput(input);
-    std::visit([&](auto&& req){handleRequest(req);}, myJsonInputVariant);
+    std::visit([&](auto&& req){
+        req.size = input.size(); // Released by writeResponse() or writeError()
+        req.channel = channel;
+        handleRequest(req);
+    }, myJsonInputVariant);
 }
 
 NativeMsgIface::~NativeMsgIface() {
     if (iothread_.joinable()) {
         iothread_.join();
     }
+
+    {
+        std::lock_guard<std::mutex> lock(loaderMutex_);
+        loaderShutdown_ = true;
+    }
+    loaderCV_.notify_all();
+    for (auto &&loader : loaders_)
+        loader.join();
 }
@@ -1,16 +1,32 @@
 #pragma once
 #include <iostream>
 
+#include <QHash>
 #include <QPair>
+#include <QSet>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <optional>
 #include <type_traits>
 #include <QEventLoop>
 #include <QJsonDocument>
+#include <QJsonValue>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QVector>
 #include "inventory/ModelManager.h"
+#include "cli/FrameWriter.h"
+#include "cli/ModelCache.h"
+#include "cli/NativeMsgStats.h"
+#include "cli/ResponseCache.h"
+#include "cli/TranslationScheduler.h"
 #include "settings/Settings.h"
 #include "MarianInterface.h"
 #include "Translation.h"
+#include "Utf8String.h"
 #include "Network.h"
 #include <memory>
 #include <variant>
@@ -21,12 +37,23 @@ namespace marian {
     class AsyncService;
     class TranslationModel;
     class Response;
+    struct ResponseOptions;
     }
 }
 
 
 const int constexpr kMaxInputLength = 10*1024*1024; // 10 MB limit on the input length via native messaging
 
+const std::size_t constexpr kMaxWordsInFlightPerWorker = 2000; // Words handed to the service per worker; the rest stays in the scheduler
+const std::size_t constexpr kMaxAlignmentsPerToken = 2; // Only the most likely source tokens for each target token are sent
+const float constexpr kMinAlignmentProbability = 0.1f; // Same threshold as the alignment highlighting in the GUI
+const int constexpr kStatsDumpInterval = 60 * 1000; // Milliseconds between writing stats to the stats_file, if set
+const std::chrono::milliseconds constexpr kModelAffinityDelay{50}; // How long work may wait while the scheduler sticks with the current model
+const std::size_t constexpr kSessionQuantum = 200; // Words a session may hand to the service per turn before the next session gets a go
+const int constexpr kStdioChannel = 0; // Channel of the messages on stdin, as opposed to those of relays (see NativeMsgIface::listen()) or HttpServer
+const std::size_t constexpr kResponseCacheMemory = 32 * 1024 * 1024; // Bytes of serialized Translate responses kept for repeated requests
+const int constexpr kRelayConnectTimeout = 1000; // Milliseconds to wait for a shared host that is listening, but busy
+
 /**
  * Incoming requests all extend Request which contains the client supplied message
  * id. This id is used in any reply to this request. See parseJsonInput() for the
@@ -56,6 +83,8 @@ const int constexpr kMaxInputLength = 10*1024*1024; // 10 MB limit on the input
  *   "id": int same value as in the request
  *   "success": false
  *   "error": str error message
+ *   "retryable": true only present if the host was too busy, and the same
+ *                request may succeed if it is sent again later
  * }
  * 
  * Generic update format:
@@ -69,10 +98,45 @@ const int constexpr kMaxInputLength = 10*1024*1024; // 10 MB limit on the input
  */
 struct Request {
     int id;
+    std::size_t size{0}; // Bytes of the message, counted against input_queue_memory until answered
+    int channel{kStdioChannel}; // Connection the message came in on, and the answer goes out on
+
+    /**
+     * Identifies a request among those of all channels. Clients pick their
+     * ids independently, so the id alone is not enough.
+     */
+    static inline qint64 key(int channel, int id) {
+        return (static_cast<qint64>(channel) << 32) | static_cast<quint32>(id);
+    }
+
+    inline qint64 key() const {
+        return key(channel, id);
+    }
 };
 
 Q_DECLARE_METATYPE(Request);
 
+/**
+ * Which models a translation request wants to use: either the src and trg
+ * languages, or a model id and optionally a pivot model id. findModels() fills
+ * in `model` and `pivot` if only `src` and `trg` are given, going by `policy`.
+ */
+struct ModelSelection {
+    QString src;
+    QString trg;
+    QString model;
+    QString pivot;
+    translateLocally::models::RoutePolicy policy{translateLocally::models::Fastest};
+
+    /**
+     * @brief sets `policy` from the "prefer" field of a request: "quality",
+     * or "speed" which is also what anything else means.
+     */
+    inline void setPolicy(QString const &prefer) {
+        policy = prefer == "quality" ? translateLocally::models::BestQuality : translateLocally::models::Fastest;
+    }
+};
+
 /**
  * Request:
  * {
@@ -82,6 +146,9 @@ Q_DECLARE_METATYPE(Request);
  *     EIHER 
  *      "src": str BCP-47 language code,
  *      "trg": str BCP-47 language code,
+ *      "prefer": str "speed" (default) or "quality", which of the installed
+ *                models to use for src and trg, directly or via any pivot
+ *                language
  *     OR
  *      "model": str model id,
  *      "pivot": str model id
@@ -90,7 +157,13 @@ Q_DECLARE_METATYPE(Request);
  *     OPTIONAL
  *      "html": bool the input is HTML
  *      "quality": bool return quality scores
- *      "alignments" return token alignments
+ *      "alignments": bool return token alignments
+ *      "priority": int requests with a higher priority are translated first (default 0)
+ *      "deadline": int milliseconds after which the request fails with
+ *                  "Deadline exceeded" if it has not been translated yet
+ *      "session": str requests of different sessions (e.g. browser tabs)
+ *                 take turns, so a large page in one session does not
+ *                 hold up others. Priority only applies within a session.
  *   }
  * }
  * 
@@ -100,21 +173,33 @@ Q_DECLARE_METATYPE(Request);
  *   "success": true,
  *   "data": {
  *     "target": {
- *       "text": str
+ *       "text": str,
+ *       "quality": { only if "quality" was requested
+ *         "sentences": [[begin: int, end: int, score: float], ...],
+ *         "words": [[begin: int, end: int, score: float], ...]
+ *       },
+ *       "alignments": [ only if "alignments" was requested
+ *         [target begin: int, target end: int, source begin: int, source end: int, probability: float],
+ *         ... at most two source tokens for every target token
+ *       ]
  *     } 
  *   }
  * }
+ * 
+ * Offsets are in UTF-16 code units, like JavaScript string indices, into
+ * "target.text" or the request's "text" respectively. Scores are log
+ * probabilities, closer to 0 is better. Word scores may be missing if they
+ * could not be matched to words in the text.
  */
-struct TranslationRequest : public Request {
-    QString src;
-    QString trg;
-    QString model;
-    QString pivot;
-    QString text;
+struct TranslationRequest : public Request, public ModelSelection {
+    Utf8String text; // Kept as UTF-8 from the moment it is parsed until it is handed to bergamot
     QString command;
     bool html{false};
     bool quality{false};
     bool alignments{false};
+    int priority{0};
+    int deadline{0}; // milliseconds, 0 means no deadline
+    QString session;
 
 
     inline void set(QString key, QJsonValueRef& val) {
@@ -126,12 +211,20 @@ struct TranslationRequest : public Request {
             model = val.toString();
         } else if (key == "pivot") {
             pivot = val.toString();
+        } else if (key == "prefer") {
+            setPolicy(val.toString());
+        } else if (key == "session") {
+            session = val.toString();
         } else if (key == "text") {
-            text = val.toString();
+            text = Utf8String::fromQString(val.toString());
         } else if (key == "command") {
             command = val.toString();
         } else if (key == "id") { // Int keys
             id = val.toInt();
+        } else if (key == "priority") {
+            priority = val.toInt();
+        } else if (key == "deadline") {
+            deadline = val.toInt();
         } else if (key == "html") { // Bool keys
             html = val.toBool();
         } else if (key == "quality") {
@@ -155,6 +248,121 @@ struct TranslationRequest : public Request {
 
 Q_DECLARE_METATYPE(TranslationRequest);
 
+/**
+ * Translate many texts with the same model(s) in one message. All texts are
+ * handed to the translation service together so they can share batches.
+ *
+ * Request:
+ * {
+ *   "id": int
+ *   "command": "TranslateBatch",
+ *   "data": {
+ *     EIHER 
+ *      "src": str BCP-47 language code,
+ *      "trg": str BCP-47 language code,
+ *      "prefer": str see Translate
+ *     OR
+ *      "model": str model id,
+ *      "pivot": str model id
+ *     REQUIRED
+ *      "texts": [
+ *        {
+ *          REQUIRED
+ *           "text": str text to translate
+ *          OPTIONAL
+ *           "html": bool the input is HTML
+ *           "id": any value, returned as-is with the translation of this item
+ *        }
+ *        ...
+ *      ]
+ *     OPTIONAL
+ *      "stream": bool send each translation as an update as soon as it is
+ *                done, instead of all of them in the final response.
+ *      "quality": bool see Translate, applies to all texts
+ *      "alignments": bool see Translate, applies to all texts
+ *      "priority": int see Translate
+ *      "deadline": int see Translate
+ *      "session": str see Translate
+ *   }
+ * }
+ * 
+ * Item update (only if "stream" is true):
+ * {
+ *   "id": int,
+ *   "update": true,
+ *   "data": {
+ *     "index": int position of the item in "texts",
+ *     "id": item id, if the item had one,
+ *     "target": {
+ *       "text": str,
+ *       ... "quality" and "alignments" as in Translate, if requested
+ *     }
+ *   }
+ * }
+ * 
+ * Success response, once all texts are translated:
+ * {
+ *   "id": int,
+ *   "success": true,
+ *   "data": [
+ *     {
+ *       "id": item id, if the item had one,
+ *       "target": {
+ *         "text": str,
+ *         ... "quality" and "alignments" as in Translate, if requested
+ *       }
+ *     }
+ *     ... in the same order as "texts"
+ *   ] or [] if "stream" is true, as the updates already carried them
+ * }
+ */
+struct TranslationBatchItem {
+    Utf8String text;
+    bool html{false};
+    QJsonValue id{QJsonValue::Undefined};
+};
+
+struct TranslationBatchRequest : public Request, public ModelSelection {
+    QVector<TranslationBatchItem> texts;
+    bool stream{false};
+    bool quality{false};
+    bool alignments{false};
+    int priority{0};
+    int deadline{0};
+    QString session;
+};
+
+Q_DECLARE_METATYPE(TranslationBatchRequest);
+
+/**
+ * Cancel a Translate or TranslateBatch request. Any of its work that has not
+ * been handed to the translation service yet is dropped, and the cancelled
+ * request is answered with the error "Request was cancelled".
+ *
+ * Request:
+ * {
+ *   "id": int,
+ *   "command": "Cancel",
+ *   "data": {
+ *     "requestID": int id of the request to cancel
+ *   }
+ * }
+ * 
+ * Successful response:
+ * {
+ *   "id": int,
+ *   "success": true,
+ *   "data": {
+ *     "cancelled": bool false if the request was already answered
+ *   }
+ * }
+ */
+struct CancelRequest : Request {
+    int requestID;
+};
+
+Q_DECLARE_METATYPE(CancelRequest);
+
 /**
  * List of available models.
  * 
@@ -236,6 +444,132 @@ struct DownloadRequest : Request {
 
 Q_DECLARE_METATYPE(DownloadRequest);
 
+/**
+ * Load the models for a language pair ahead of time, so the first Translate
+ * request for it doesn't have to wait for them. Models are kept loaded like
+ * any other recently used model.
+ *
+ * Request:
+ * {
+ *   "id": int,
+ *   "command": "LoadModel",
+ *   "data": {
+ *     EIHER 
+ *      "src": str BCP-47 language code,
+ *      "trg": str BCP-47 language code,
+ *      "prefer": str see Translate
+ *     OR
+ *      "model": str model id,
+ *      "pivot": str model id
+ *     OPTIONAL
+ *      "alignments": bool load the models such that Translate requests with
+ *                    "alignments" can use them
+ *   }
+ * }
+ * 
+ * Loading progress update, for every model that was not loaded yet:
+ * {
+ *   "id": int,
+ *   "update": true,
+ *   "data": {
+ *     "loading": str model id
+ *   }
+ * }
+ * 
+ * Successful response, once all models are loaded:
+ * {
+ *   "id": int,
+ *   "success": true,
+ *   "data": {
+ *     "models": [str model id, ...]
+ *   }
+ * }
+ */
+struct LoadModelRequest : Request, ModelSelection {
+    bool alignments{false};
+};
+
+Q_DECLARE_METATYPE(LoadModelRequest);
+
+/**
+ * Unload the models for a language pair to free up memory. Translations that
+ * are still in progress keep their models until they are done.
+ *
+ * Request:
+ * {
+ *   "id": int,
+ *   "command": "UnloadModel",
+ *   "data": {
+ *     EIHER 
+ *      "src": str BCP-47 language code,
+ *      "trg": str BCP-47 language code,
+ *      "prefer": str see Translate
+ *     OR
+ *      "model": str model id,
+ *      "pivot": str model id
+ *   }
+ * }
+ * 
+ * Successful response:
+ * {
+ *   "id": int,
+ *   "success": true,
+ *   "data": {
+ *     "unloaded": [str model id, ...] models that were loaded
+ *   }
+ * }
+ */
+struct UnloadModelRequest : Request, ModelSelection {
+    //
+};
+
+Q_DECLARE_METATYPE(UnloadModelRequest);
+
+/**
+ * Diagnostics: what the host is doing and how long things take. All latency
+ * histograms have the format described at LatencyHistogram::toJson().
+ *
+ * Request:
+ * {
+ *   "id": int,
+ *   "command": "Stats",
+ *   "data": {}
+ * }
+ * 
+ * Successful response:
+ * {
+ *   "id": int,
+ *   "success": true,
+ *   "data": {
+ *     "uptime": int seconds,
+ *     "rss": int resident memory in bytes, -1 if unknown,
+ *     "operations": int requests that have not been answered yet,
+ *     "channels": int relays and HTTP connections,
+ *     "queued": int translation jobs waiting for the service,
+ *     "queued_words": int words in those jobs, see max_queued_words,
+ *     "sessions": {str session: int queued jobs, ...},
+ *     "counters": {
+ *       "requests", "errors", "bytes_in", "bytes_out", "coalesced", "response_cache_hits",
+ *       "model_cache_hits", "model_cache_misses", "model_load_failures": int
+ *     },
+ *     "latency": {
+ *       "queue_wait", "translate", "serialize", "model_load": histogram
+ *     },
+ *     "model_cache": {
+ *       "budget": int bytes,
+ *       "used": int bytes,
+ *       "loading": int models being loaded,
+ *       "models": [{"id": str, "size": int bytes, "load_ms": int}, ...]
+ *     }
+ *   }
+ * }
+ */
+struct StatsRequest : Request {
+    //
+};
+
+Q_DECLARE_METATYPE(StatsRequest);
+
 /**
  * Internal structure to handle a request that is missing a required field.
  */
@@ -243,10 +577,10 @@ struct MalformedRequest : Request {
     QString error;
 };
 
-using request_variant = std::variant<TranslationRequest, ListRequest, DownloadRequest, MalformedRequest>;
+using request_variant = std::variant<TranslationRequest, TranslationBatchRequest, CancelRequest, ListRequest, DownloadRequest, LoadModelRequest, UnloadModelRequest, StatsRequest, MalformedRequest>;
 
 /**
- * Internal structure to cache a loaded direct model (i.e. no pivoting)
+ * Internal structure for a loaded direct model (i.e. no pivoting)
  */
 struct DirectModelInstance {
     QString modelID;
@@ -254,7 +588,8 @@ struct DirectModelInstance {
 };
 
 /**
- * Internal structure to cache a loaded indirect model (i.e. needs to pivot)
+ * Internal structure for a loaded indirect model (i.e. needs to pivot). Both
+ * models come out of the same ModelCache as direct models do.
  */
 struct PivotModelInstance {
     QString modelID;
@@ -275,29 +610,148 @@ public:
     explicit NativeMsgIface(QObject * parent=nullptr);
     ~NativeMsgIface();
 
+    /**
+     * @brief also serve translateLocally processes that connect to the local
+     * socket `name`, so they can relay the messages of their own browser
+     * instead of loading models of their own (see NativeMsgRelay). Every
+     * connection is a channel, with its own message ids. Call before run().
+     * @return false if the socket could not be set up, e.g. because another
+     * host is listening on it already.
+     */
+    bool listen(QString const &name);
+
+    /**
+     * @brief opens a channel for messages that come from somewhere other
+     * than stdin or a relay, e.g. HttpServer. Messages for the channel are
+     * passed to `write` on the main thread, with `final` set if the message
+     * answers a request, as opposed to an update.
+     * @return the channel, for submit() and closeChannel().
+     */
+    int openChannel(std::function<void(QByteArray const &message, bool final)> write);
+
+    /**
+     * @brief handles a message on a channel from openChannel() as if it was
+     * read from stdin. Main thread only.
+     * @return false if the input budget is used up. The message is dropped,
+     * the caller can try again later.
+     */
+    bool submit(int channel, QByteArray const &message);
+
 public slots:
     void run();
 
+    /**
+     * @brief aborts the channel's requests and forgets about it. Hooked to a
+     * relay's disconnected.
+     */
+    void closeChannel(int channel);
+
 private slots:
     /**
      * @brief hooked to emitJson, called for every message that the native client
      * receives, parses its json into a Request using `parseJsonInput`, and then
      * calls the corresponding `handleRequest` overload.
      * @param input char array of json
+     * @param channel the message came in on, see Request::channel
      */
-    void processJson(QByteArray input);
+    void processJson(QByteArray input, int channel);
+
+    /**
+     * @brief hooked to the server's newConnection, sets up a channel for
+     * every relay that connects.
+     */
+    void acceptConnections();
+
+    /**
+     * @brief processes all complete messages a relay has sent, as far as
+     * the input budget allows.
+     */
+    void readChannel(int channel);
+
+    /**
+     * @brief hooked to inputReleased, picks up reading the channels that
+     * stopped because the input budget was used up.
+     */
+    void readChannels();
+
+    /**
+     * @brief hooked to channelOutput, hands a message to the writer of its
+     * channel. Closes a relay's channel if the relay has no more input and
+     * this was the last answer it was waiting for.
+     */
+    void writeChannel(int channel, QByteArray message, bool final);
+
+    /**
+     * @brief hooked to inputClosed. Once stdin is closed and all relays are
+     * gone, we're done.
+     */
+    void closeInput();
+
+    /**
+     * @brief hooked to modelLoaded, adds freshly loaded models to the cache
+     * and resumes the requests that were waiting for them.
+     */
+    void processLoadedModels();
 
 private:
+    using ModelPtr = std::shared_ptr<marian::bergamot::TranslationModel>;
+
+    // A model for the loader thread to load, and once it is done, the result.
+    struct LoadJob {
+        QString key; // See loadKey()
+        Model model;
+        bool alignment{false};
+        translateLocally::marianSettings settings;
+        ModelPtr loaded; // nullptr if loading failed
+        std::size_t size{0};
+        std::chrono::steady_clock::duration loadTime{0};
+    };
+
+    // Updated from all threads, so declared before any of them.
+    NativeMsgStats stats_;
+
     // Threading
     std::thread iothread_;
     //QEventLoop eventLoop_;
-    std::mutex coutmutex_;
+
+    // Models are loaded on threads of their own, so requests for models
+    // that are already loaded don't have to wait. How many models load at
+    // the same time is limited by the number of loader threads.
+    std::vector<std::thread> loaders_;
+    std::mutex loaderMutex_;
+    std::condition_variable loaderCV_;
+    bool loaderShutdown_{false};
+    std::deque<LoadJob> loadQueue_; // Waiting to be loaded
+    std::deque<LoadJob> loadedQueue_; // Waiting to be picked up by processLoadedModels()
+
+    // Continuations waiting for a model to load, by loadKey(). Main thread only.
+    QHash<QString, QList<std::function<void(ModelPtr)>>> loading_;
+
+    // How long each cached model took to load in milliseconds, by model id. Main thread only.
+    QHash<QString, qint64> loadTimes_;
+
+    // Ids of the models that were loaded to compute alignments. Their
+    // instance in the model cache serves all requests. Main thread only.
+    QSet<QString> alignmentModels_;
+
+    // Declared before anything that can write messages, so it is destroyed,
+    // and thereby drained, last.
+    FrameWriter writer_;
     
     // Sadly we don't have C++20 on ubuntu 18.04, otherwise could use std::atomic<T>::wait
     std::atomic<int> operations_; // Keeps track of all operations. So that we know when to quit
     std::mutex pendingOpsMutex_;
     std::condition_variable pendingOpsCV_;
 
+    // Admission control: the reader thread stops taking messages from stdin
+    // while the messages that have not been answered yet take up more than
+    // maxQueuedBytes_. The browser then can't write any more either.
+    std::mutex admissionMutex_;
+    std::condition_variable admissionCV_;
+    std::size_t queuedBytes_;
+    std::size_t maxQueuedBytes_;
+    bool inputStalled_{false}; // A relay channel is waiting for room in the budget
+
     // Marian shared ptr. We should be using a unique ptr but including the actual header breaks QT compilation. Sue me.
     std::shared_ptr<marian::bergamot::AsyncService> service_;
 
@@ -307,7 +761,74 @@ private:
     ModelManager models_;
     QMap<QString, QMap<QString, QList<Model>>> modelMap_;
 
-    std::optional<ModelInstance> model_;
+    // Loaded models, so switching between recently used pairs does not reload
+    // them from disk.
+    ModelCache modelCache_;
+
+    // Serialized answers to recent Translate requests. Disabled along with
+    // the translation cache setting.
+    ResponseCache responseCache_;
+
+    // Translation work waiting for the service, most important first.
+    TranslationScheduler scheduler_;
+
+    // Translations that would push the scheduler past this many queued words
+    // are turned away with a retryable error.
+    std::size_t maxQueuedWords_;
+
+    // How to abort each translation request that has not been answered yet.
+    // Used by Cancel requests. An abort handler returns false if the request
+    // was already answered.
+    std::mutex abortMutex_;
+    QHash<qint64, std::function<bool(QString)>> abortHandlers_; // by Request::key()
+
+    // A request waiting for a translation that is in flight.
+    struct Waiter {
+        std::function<void(QByteArray const &)> deliver; // Receives the serialized "data" object
+        std::function<bool(QString)> abort;
+    };
+
+    // Translate requests that are being translated right now, keyed by
+    // flightKey(). Identical requests that come in while one is in flight
+    // wait for its result instead of translating the same text again.
+    struct Flight {
+        qint64 jobID; // requestID of the scheduled job
+        QHash<qint64, Waiter> waiters; // by Request::key()
+    };
+
+    std::mutex flightsMutex_;
+    QHash<QString, Flight> flights_;
+
+    // Time the service spends on each model, by model id. Jobs of the same
+    // model overlap, so the model counts as busy from when the first one is
+    // handed over until the last one is done. Words over that time is how
+    // fast it is, however many of its jobs are in the service at once.
+    struct Busy {
+        int jobs{0};
+        std::chrono::steady_clock::time_point since; // Busy time is counted up to here
+    };
+
+    std::mutex busyMutex_;
+    QHash<QString, Busy> busy_;
+
+    // A flight outlives the request that started it, so its job is scheduled
+    // under an id of its own. Negative, so it never matches a Request::key()
+    // a Cancel could name. Guarded by flightsMutex_.
+    qint64 nextFlightJobID_{-1};
+
+    // Relays connected through listen() and channels from openChannel(),
+    // by channel. Main thread only.
+    struct Channel {
+        std::function<void(QByteArray const &, bool)> write;
+        QLocalSocket *socket{nullptr}; // Only for relays
+        int pending{0}; // Messages that have not been answered yet
+        bool closing{false}; // The relay's input is closed, see NativeMsgRelay
+    };
+
+    QLocalServer *server_{nullptr};
+    QHash<int, Channel> channels_;
+    int nextChannel_{kStdioChannel + 1};
+    bool inputClosed_{false}; // stdin is closed and its requests are answered
 
     // Methods
     request_variant parseJsonInput(QByteArray bytes);
@@ -318,49 +839,199 @@ private:
      * the target language/languages. The id of the found model (and possibly
      * pivot model) will be filled in in the `request` and the function will
      * return `true`.
-     * @param TranslationRequest request
+     * @param ModelSelection request
      * @return whether we succeeded or not.
      */
-    bool findModels(TranslationRequest &request) const;
+    bool findModels(ModelSelection &request) const;
 
     /**
-     * @brief Loads the models specified in the request. Assumes `request.model`
-     * and possibly `request.pivot` are filled in.
-     * @param TranslationRequest request with `model` (and optionally `pivot`)
+     * @brief Calls `then` with the models specified in the request, taken
+     * from the model cache or loaded on the loader thread. In the latter
+     * case `then` is called later, from the main thread. Assumes
+     * `request.model` and possibly `request.pivot` are filled in.
+     * @param ModelSelection request with `model` (and optionally `pivot`)
      * filled in.
-     * @return Returns false if any of the necessary models is either not found
-     * or not downloaded.
+     * @param alignment whether the models have to compute alignments.
+     * @param then receives nullopt if any of the necessary models is either
+     * not found, not downloaded or failed to load.
+     * @param held models already loaded for this request.
+     */
+    void withModels(ModelSelection const &request, bool alignment, std::function<void(std::optional<ModelInstance>)> then, QHash<QString, ModelPtr> held = {});
+
+    /**
+     * @brief identifies a model being loaded, with or without alignments.
+     * Loaded models go into the model cache by model id either way.
+     */
+    QString loadKey(Model const &model, bool alignment) const;
+
+    /**
+     * @brief returns the model from the cache, or nullptr if it isn't loaded.
      */
-    bool loadModels(TranslationRequest const &request);
+    ModelPtr cachedModel(Model const &model, bool alignment);
 
     /**
-     * @brief instantiates a model that will work with the service.
+     * @brief queues a model to be loaded on the loader thread. `then` is
+     * called from the main thread once the model is in the cache, or with
+     * nullptr if it failed to load.
+     */
+    void loadModel(Model const &model, bool alignment, std::function<void(ModelPtr)> then);
+
+    /**
+     * @brief loader thread main loop. Loads models from the queue one at a time.
+     */
+    void runLoader();
+
+    /**
+     * @brief instantiates a model that will work with the service. Called
+     * on the loader thread, hence the settings are passed in.
      * @returns model instance.
      */
-    std::shared_ptr<marian::bergamot::TranslationModel> makeModel(Model const &model);
+    ModelPtr makeModel(Model const &model, bool alignment, translateLocally::marianSettings const &settings);
+
+    /**
+     * @brief subtracts the time since `received` from a request deadline.
+     * @return false if the deadline has passed already.
+     */
+    bool remainingDeadline(int &deadline, std::chrono::steady_clock::time_point received) const;
+
+    /**
+     * @brief second half of handleRequest(TranslationRequest), once the
+     * models are loaded. The response is stored in the response cache under
+     * its flightKey().
+     */
+    void translateRequest(TranslationRequest request, ModelInstance instance);
+
+    /**
+     * @brief second half of handleRequest(TranslationBatchRequest), once the
+     * models are loaded.
+     */
+    void translateRequest(TranslationBatchRequest request, ModelInstance instance);
 
     /**
-     * @brief lockAndWriteJsonHelper This function locks input stream and then writes the size and a
-     *                               json message after. It would be called in many places so it
-     *                               makes sense to put the common bits here to avoid code duplication.
-     * @param json QJsonDocument that will be stringified and written to stdout in a blocking fashion.
+     * @brief hands text to the service, using either a direct or a pivot model.
+     * Once it is translated, the `words` and the time the model was busy for
+     * them go to translated().
      */
-    void lockAndWriteJsonHelper(QJsonDocument&& json);
+    void translate(ModelInstance &instance, std::string &&text, std::size_t words, std::function<void(marian::bergamot::Response&&)> callback, marian::bergamot::ResponseOptions const &options);
+
+    /**
+     * @brief counts a job of this model that is handed to the service.
+     */
+    void startBusy(QString const &modelID);
+
+    /**
+     * @brief counts a job of this model as done at `now`.
+     * @return seconds the model was busy since the last job of it was done,
+     * or since it got busy.
+     */
+    double endBusy(QString const &modelID, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief register how to abort a request, so Cancel can find it.
+     * @return false if a request with the same key is still being tracked.
+     */
+    bool trackRequest(qint64 key, std::function<bool(QString)> abort);
+
+    /**
+     * @brief forget a request once it has been answered.
+     */
+    void untrackRequest(qint64 key);
+
+    /**
+     * @brief abort a request once its deadline passes.
+     */
+    void expireAfter(qint64 key, int milliseconds, std::function<bool(QString)> abort);
+
+    /**
+     * @brief identifies a translation request by its models, options and the
+     * SHA-256 digest of its text, after findModels(). Identical requests
+     * produce identical translations, so this also keys the response cache.
+     */
+    QString flightKey(TranslationRequest const &request) const;
+
+    /**
+     * @brief waits for the translation with this key. If none is in flight,
+     * one is started with this request as the first waiter.
+     * @return if a flight was started, the requestID the caller has to
+     * submit its job under.
+     */
+    std::optional<qint64> joinFlight(QString const &key, qint64 requestKey, Waiter waiter);
+
+    /**
+     * @brief stops waiting for a translation, e.g. because the request was
+     * cancelled. The last one to leave drops the work if it is still queued.
+     */
+    void leaveFlight(QString const &key, qint64 requestKey);
+
+    /**
+     * @brief ends a flight. Returns everyone who was waiting for it.
+     */
+    QList<Waiter> landFlight(QString const &key);
+
+    /**
+     * @brief waits until there is room for a message of `size` bytes in the
+     * input budget, and claims it. Called from the reader thread. A message
+     * always fits if nothing else is waiting to be answered.
+     */
+    void admitInput(std::size_t size);
+
+    /**
+     * @brief like admitInput(), but doesn't wait. For relay channels, which
+     * are read on the main thread. If there is no room, inputReleased is
+     * emitted once there is.
+     */
+    bool tryAdmitInput(std::size_t size);
+
+    /**
+     * @brief gives the bytes of an answered request back to the input budget.
+     */
+    void releaseInput(Request const &request);
+
+    /**
+     * @brief whether the scheduler can take `words` more words of work. If
+     * not, the request is answered with a retryable error.
+     */
+    bool admitWords(Request const &request, std::size_t words);
+
+    /**
+     * @brief writeJsonHelper serialises a json message (compact, no whitespace) and hands it to the
+     *                        writer thread, which frames it and writes it to stdout. It would be called
+     *                        in many places so it makes sense to put the common bits here to avoid code
+     *                        duplication.
+     * @param request the message is about. Messages go out on the channel of their request.
+     * @param json QJsonDocument that will be stringified and written to stdout. Does not block on stdout.
+     * @param final whether this answers the request, as opposed to an update.
+     */
+    void writeJsonHelper(Request const &request, QJsonDocument&& json, bool final);
+
+    /**
+     * @brief hands a serialised message to the writer thread if it is for
+     * stdin, or to writeChannel() on the main thread otherwise.
+     */
+    void writeFrame(int channel, QByteArray const &message, bool final);
 
     template <typename T> // T can be QJsonValue, QJsonArray or QJsonObject
     void writeResponse(Request const &request, T &&data) {
         // Decrement pending operation count
         operations_--;
         pendingOpsCV_.notify_one();
+        releaseInput(request);
         
         QJsonObject response = {
             {"success", true},
             {"id", request.id},
             {"data", std::move(data)}
         };
-        lockAndWriteJsonHelper(QJsonDocument(std::move(response)));
+        writeJsonHelper(request, QJsonDocument(std::move(response)), true);
     }
 
+    /**
+     * @brief like writeResponse(), but with `data` already serialized to
+     * compact JSON, e.g. taken from the response cache. Only the envelope
+     * with the request id is added around it.
+     */
+    void writeSerializedResponse(Request const &request, QByteArray const &data);
+
     template <typename T>
     void writeUpdate(Request const &request, T &&data) {
         QJsonObject response = {
@@ -368,28 +1039,33 @@ private:
             {"id", request.id},
             {"data", std::move(data)}
         };
-        lockAndWriteJsonHelper(QJsonDocument(std::move(response)));
+        writeJsonHelper(request, QJsonDocument(std::move(response)), false);
     }
 
-    void writeError(Request const &request, QString &&err) {
+    void writeError(Request const &request, QString &&err, bool retryable = false) {
         // Only writeResponse or writeError will decrement the counter, and thus
         // only one should be called once per request. We can verify this by
         // looking at the message ids in request, but that's too much runtime
         // checking. I did do it in debug code.
         operations_--;
         pendingOpsCV_.notify_one();
+        releaseInput(request);
+        stats_.errors++;
         
         QJsonObject response{
             {"success", false},
             {"error", err}
         };
 
+        if (retryable)
+            response["retryable"] = true;
+
         // We have request.id == -1 if the error is that the message id could
         // not be parsed.
         if (request.id >= 0)
             response["id"] = request.id;
 
-        lockAndWriteJsonHelper(QJsonDocument(std::move(response)));
+        writeJsonHelper(request, QJsonDocument(std::move(response)), true);
     }
 
     /**
@@ -398,6 +1074,18 @@ private:
      */
     void handleRequest(TranslationRequest myJsonInput);
 
+    /**
+     * @brief handleRequest handles a request type TranslationBatchRequest and writes to stdout
+     * @param myJsonInput TranslationBatchRequest
+     */
+    void handleRequest(TranslationBatchRequest myJsonInput);
+
+    /**
+     * @brief handleRequest handles a request type CancelRequest and writes to stdout
+     * @param myJsonInput CancelRequest
+     */
+    void handleRequest(CancelRequest myJsonInput);
+
     /**
      * @brief handleRequest handles a request type ListRequest and writes to stdout
      * @param myJsonInput ListRequest
@@ -410,6 +1098,34 @@ private:
      */
     void handleRequest(DownloadRequest myJsonInput);
 
+    /**
+     * @brief handleRequest handles a request type LoadModelRequest and writes to stdout
+     * @param myJsonInput LoadModelRequest
+     */
+    void handleRequest(LoadModelRequest myJsonInput);
+
+    /**
+     * @brief handleRequest handles a request type UnloadModelRequest and writes to stdout
+     * @param myJsonInput UnloadModelRequest
+     */
+    void handleRequest(UnloadModelRequest myJsonInput);
+
+    /**
+     * @brief handleRequest handles a request type StatsRequest and writes to stdout
+     * @param myJsonInput StatsRequest
+     */
+    void handleRequest(StatsRequest myJsonInput);
+
+    /**
+     * @brief everything the Stats command reports.
+     */
+    QJsonObject statsJson() const;
+
+    /**
+     * @brief writes statsJson() to the file configured in the stats_file setting.
+     */
+    void dumpStats() const;
+
     /**
      * @brief handleRequest handles a request type MalformedRequest and writes to stdout
      * @param myJsonInput MalformedRequest
@@ -425,6 +1141,38 @@ signals:
     /**
      * @brief Internal signal that is emitted from the stdin reading thread whenever a full request message is read.
      * @param input QByteArray of the json message
+     * @param channel always kStdioChannel
+     */
+    void emitJson(QByteArray input, int channel);
+
+    /**
+     * @brief Internal signal that is emitted from the stdin reading thread
+     * once stdin is closed and all its messages are answered.
+     */
+    void inputClosed();
+
+    /**
+     * @brief Internal signal that is emitted, from any thread, when there is
+     * room in the input budget again for a relay channel that ran out.
+     */
+    void inputReleased();
+
+    /**
+     * @brief Internal signal that is emitted, from any thread, for every
+     * message that goes out to a relay.
+     */
+    void channelOutput(int channel, QByteArray message, bool final);
+
+    /**
+     * @brief Internal signal that is emitted from the service's threads
+     * whenever a direct model finished a translation: its words, and the
+     * seconds the model was busy since it last finished one. See
+     * ModelManager::recordSpeed().
+     */
+    void translated(QString modelID, int words, double seconds);
+
+    /**
+     * @brief Internal signal that is emitted from the model loader thread whenever a model is loaded.
      */
-    void emitJson(QByteArray input);
+    void modelLoaded();
 };
@@ -0,0 +1,150 @@
+#include "NativeMsgRelay.h"
+#include "cli/NativeMsgIface.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#if defined(Q_OS_WIN)
+// for _setmode, _fileno and _O_BINARY on Windows
+#include <fcntl.h>
+#include <io.h>
+#elif defined(Q_OS_UNIX)
+// for getuid()
+#include <unistd.h>
+#endif
+
+NativeMsgRelay::NativeMsgRelay(QLocalSocket *socket, QObject *parent)
+: QObject(parent)
+, socket_(socket)
+, readerDone_(false)
+, backlog_(0)
+, disconnected_(false) {
+    socket_->setParent(this);
+
+    std::ios_base::sync_with_stdio(false);
+    std::cin.tie(NULL);
+
+    connect(this, &NativeMsgRelay::emitFrame, this, &NativeMsgRelay::forwardInput);
+    connect(socket_, &QLocalSocket::readyRead, this, &NativeMsgRelay::forwardOutput);
+    connect(socket_, &QLocalSocket::bytesWritten, this, &NativeMsgRelay::inputWritten);
+    connect(socket_, &QLocalSocket::disconnected, this, [this]() {
+        {
+            std::lock_guard<std::mutex> lock(backlogMutex_);
+            disconnected_ = true;
+        }
+        backlogCV_.notify_one();
+        emit finished();
+    });
+}
+
+NativeMsgRelay::~NativeMsgRelay() {
+    if (!iothread_.joinable())
+        return;
+
+    if (readerDone_) {
+        iothread_.join();
+        return;
+    }
+
+    // The host went away while the browser is still connected, so the
+    // reader is stuck reading stdin. Nothing portable interrupts that, and
+    // the thread must not be left running into static destruction, where
+    // std::cin goes away underneath it. Everything for the browser has been
+    // written by now, so leave right here.
+    std::cout.flush();
+    std::_Exit(EXIT_FAILURE);
+}
+
+NativeMsgRelay *NativeMsgRelay::connectTo(QString const &name, QObject *parent) {
+    QLocalSocket *socket = new QLocalSocket();
+    socket->connectToServer(name);
+    if (!socket->waitForConnected(kRelayConnectTimeout)) {
+        delete socket;
+        return nullptr;
+    }
+
+    return new NativeMsgRelay(socket, parent);
+}
+
+QString NativeMsgRelay::hostName() {
+    // Local server names are shared between users on some platforms, and
+    // the host answers anyone who connects. Environment variables can be
+    // anything, so on Unix go by the uid.
+#if defined(Q_OS_UNIX)
+    QString user = QString::number(::getuid());
+#else
+    QString user = QString::fromLocal8Bit(qgetenv("USERNAME"));
+#endif
+    return QString("%1-%2").arg(QCoreApplication::applicationName(), user);
+}
+
+void NativeMsgRelay::run() {
+#if defined(Q_OS_WIN)
+    // See NativeMsgIface::run()
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    iothread_ = std::thread([this](){
+        for (;;) {
+            char len[4];
+            if (!std::cin.read(len, 4))
+                break;
+
+            // Same checks as the host does, so we don't send it garbage.
+            std::uint32_t ilen = *reinterpret_cast<std::uint32_t *>(len);
+            if (ilen >= kMaxInputLength || ilen < 2) {
+                std::cerr << "Invalid message size. Shutting down." << std::endl;
+                break;
+            }
+
+            QByteArray frame(sizeof(ilen) + ilen, 0);
+            std::copy(len, len + sizeof(ilen), frame.data());
+            if (!std::cin.read(frame.data() + sizeof(ilen), ilen)) {
+                std::cerr << "Error while reading input message of length " << ilen << ". Shutting down." << std::endl;
+                break;
+            }
+
+            // Stop reading while the host isn't keeping up, so the browser
+            // has to wait instead of us buffering everything.
+            {
+                std::unique_lock<std::mutex> lock(backlogMutex_);
+                backlogCV_.wait(lock, [this]() {
+                    return backlog_ < kMaxRelayBacklog || disconnected_;
+                });
+                if (disconnected_) {
+                    readerDone_ = true;
+                    return;
+                }
+                backlog_ += frame.size();
+            }
+
+            emit emitFrame(frame);
+        }
+
+        // An empty frame tells the host there is no more input.
+        emit emitFrame(QByteArray(sizeof(std::uint32_t), 0));
+        readerDone_ = true;
+    });
+}
+
+void NativeMsgRelay::forwardInput(QByteArray frame) {
+    socket_->write(frame);
+}
+
+void NativeMsgRelay::forwardOutput() {
+    QByteArray output = socket_->readAll();
+    std::cout.write(output.constData(), output.size());
+    std::cout.flush();
+}
+
+void NativeMsgRelay::inputWritten(qint64 bytes) {
+    {
+        std::lock_guard<std::mutex> lock(backlogMutex_);
+        backlog_ -= std::min(backlog_, static_cast<std::size_t>(bytes));
+    }
+    backlogCV_.notify_one();
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <QByteArray>
+#include <QLocalSocket>
+#include <QObject>
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+const std::size_t constexpr kMaxRelayBacklog = 16 * 1024 * 1024; // Bytes read from stdin but not yet taken by the host before the relay stops reading
+
+/**
+ * Native messaging host for when another translateLocally process hosts the
+ * translation engine already (see NativeMsgIface::listen()). Browsers start
+ * a host of their own for every profile; with the shared_native_host
+ * setting, only the first one loads models, and later ones relay through
+ * this class instead.
+ *
+ * Frames from the browser on stdin are passed to the host over the local
+ * socket as they are, and frames from the host are written to stdout as
+ * they are. Nothing is parsed here. Once stdin is closed, the relay sends
+ * an empty frame to tell the host, which hangs up when it has answered
+ * everything.
+ */
+class NativeMsgRelay : public QObject {
+    Q_OBJECT
+
+public:
+    /**
+     * @brief takes over a socket that is connected to the host.
+     */
+    NativeMsgRelay(QLocalSocket *socket, QObject *parent = nullptr);
+
+    /**
+     * If the reader thread is still blocked on stdin, which happens when the
+     * host goes away before the browser closes stdin, this ends the process.
+     */
+    ~NativeMsgRelay();
+
+    /**
+     * @brief connects to the host listening on `name`.
+     * @return the relay, or nullptr if nobody is listening.
+     */
+    static NativeMsgRelay *connectTo(QString const &name, QObject *parent = nullptr);
+
+    /**
+     * @brief name of the local socket the shared host of this user listens on.
+     */
+    static QString hostName();
+
+public slots:
+    void run();
+
+private slots:
+    /**
+     * @brief hooked to emitFrame, passes a frame from stdin on to the host.
+     */
+    void forwardInput(QByteArray frame);
+
+    /**
+     * @brief hooked to the socket's readyRead, passes frames from the host
+     * on to stdout.
+     */
+    void forwardOutput();
+
+    /**
+     * @brief hooked to the socket's bytesWritten, lets the reader thread
+     * read more.
+     */
+    void inputWritten(qint64 bytes);
+
+private:
+    QLocalSocket *socket_;
+    std::thread iothread_;
+    std::atomic<bool> readerDone_; // The reader thread is done with stdin
+
+    // Bytes the reader thread read from stdin that are not written to the
+    // socket yet. The reader waits while there are too many.
+    std::mutex backlogMutex_;
+    std::condition_variable backlogCV_;
+    std::size_t backlog_;
+    bool disconnected_;
+
+signals:
+    /**
+     * @brief Emitted when the host hung up, either because it answered
+     * everything after stdin was closed, or because it went away.
+     */
+    void finished();
+
+    /**
+     * @brief Internal signal that is emitted from the stdin reading thread
+     * for every frame read, including its length.
+     */
+    void emitFrame(QByteArray frame);
+};
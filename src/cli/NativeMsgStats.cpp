@@ -0,0 +1,126 @@
+#include "NativeMsgStats.h"
+#include <QJsonArray>
+#include <algorithm>
+#include <cmath>
+
+#if defined(Q_OS_LINUX)
+#include <fstream>
+#include <unistd.h>
+#elif defined(Q_OS_MACOS)
+#include <mach/mach.h>
+#endif
+
+namespace {
+
+double toMilliseconds(std::uint64_t microseconds) {
+    return std::round(microseconds / 10.0) / 100.0;
+}
+
+} // Anonymous namespace
+
+LatencyHistogram::LatencyHistogram()
+: count_(0)
+, sum_(0)
+, max_(0) {
+    for (auto &&bucket : buckets_)
+        bucket = 0;
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration duration) {
+    auto microseconds = static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
+
+    std::size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (std::uint64_t(1) << bucket) <= microseconds)
+        ++bucket;
+
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(microseconds, std::memory_order_relaxed);
+
+    std::uint64_t max = max_.load(std::memory_order_relaxed);
+    while (max < microseconds && !max_.compare_exchange_weak(max, microseconds, std::memory_order_relaxed));
+}
+
+QJsonObject LatencyHistogram::toJson() const {
+    std::array<std::uint64_t, kBuckets> buckets;
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+        buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        count += buckets[i];
+    }
+
+    auto percentile = [&](double fraction) {
+        std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(fraction * count));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+                return toMilliseconds(std::uint64_t(1) << i);
+        }
+        return 0.0;
+    };
+
+    // Leave off the empty buckets at the end, they're most of them.
+    std::size_t used = kBuckets;
+    while (used > 0 && buckets[used - 1] == 0)
+        --used;
+
+    QJsonArray counts;
+    for (std::size_t i = 0; i < used; ++i)
+        counts.append(static_cast<qint64>(buckets[i]));
+
+    return QJsonObject{
+        {"count", static_cast<qint64>(count)},
+        {"mean_ms", count ? toMilliseconds(sum_.load(std::memory_order_relaxed) / count) : 0.0},
+        {"p50_ms", percentile(0.50)},
+        {"p90_ms", percentile(0.90)},
+        {"p99_ms", percentile(0.99)},
+        {"max_ms", toMilliseconds(max_.load(std::memory_order_relaxed))},
+        {"buckets", counts}
+    };
+}
+
+QJsonObject NativeMsgStats::toJson() const {
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started);
+
+    return QJsonObject{
+        {"uptime", static_cast<qint64>(uptime.count())},
+        {"rss", residentMemory()},
+        {"counters", QJsonObject{
+            {"requests", static_cast<qint64>(requests.load())},
+            {"errors", static_cast<qint64>(errors.load())},
+            {"bytes_in", static_cast<qint64>(bytesIn.load())},
+            {"bytes_out", static_cast<qint64>(bytesOut.load())},
+            {"coalesced", static_cast<qint64>(coalesced.load())},
+            {"response_cache_hits", static_cast<qint64>(responseCacheHits.load())},
+            {"model_cache_hits", static_cast<qint64>(modelCacheHits.load())},
+            {"model_cache_misses", static_cast<qint64>(modelCacheMisses.load())},
+            {"model_load_failures", static_cast<qint64>(modelLoadFailures.load())}
+        }},
+        {"latency", QJsonObject{
+            {"queue_wait", queueWait.toJson()},
+            {"translate", translate.toJson()},
+            {"serialize", serialize.toJson()},
+            {"model_load", modelLoad.toJson()}
+        }}
+    };
+}
+
+qint64 NativeMsgStats::residentMemory() {
+#if defined(Q_OS_LINUX)
+    // Second field of statm is the resident set size in pages.
+    std::ifstream statm("/proc/self/statm");
+    long long size, resident;
+    if (statm >> size >> resident)
+        return resident * sysconf(_SC_PAGESIZE);
+    return -1;
+#elif defined(Q_OS_MACOS)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        return static_cast<qint64>(info.resident_size);
+    return -1;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <QJsonObject>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Histogram of durations with power-of-two buckets: bucket i counts the
+ * durations of less than 2^i microseconds (and at least 2^(i-1)). Recording
+ * is lock-free so it can be done from any thread, including the service's
+ * worker threads.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(std::chrono::steady_clock::duration duration);
+
+    /**
+     * {"count": int, "mean_ms": float, "p50_ms": float, "p90_ms": float,
+     *  "p99_ms": float, "max_ms": float, "buckets": [int, ...]}
+     * Percentiles are the upper bound of the bucket they fall in.
+     */
+    QJsonObject toJson() const;
+
+private:
+    static constexpr std::size_t kBuckets = 32; // Up to about 35 minutes
+
+    std::array<std::atomic<std::uint64_t>, kBuckets> buckets_;
+    std::atomic<std::uint64_t> count_;
+    std::atomic<std::uint64_t> sum_; // microseconds
+    std::atomic<std::uint64_t> max_; // microseconds
+};
+
+/**
+ * Counters and histograms of the native messaging host, reported by the Stats
+ * command. Everything in here can be updated from any thread.
+ */
+struct NativeMsgStats {
+    std::chrono::steady_clock::time_point started{std::chrono::steady_clock::now()};
+
+    std::atomic<std::uint64_t> requests{0};
+    std::atomic<std::uint64_t> errors{0};
+    std::atomic<std::uint64_t> bytesIn{0};
+    std::atomic<std::uint64_t> bytesOut{0};
+    std::atomic<std::uint64_t> coalesced{0}; // Translate requests that joined an identical one in flight
+    std::atomic<std::uint64_t> responseCacheHits{0}; // Translate requests answered from the ResponseCache
+    std::atomic<std::uint64_t> modelCacheHits{0};
+    std::atomic<std::uint64_t> modelCacheMisses{0};
+    std::atomic<std::uint64_t> modelLoadFailures{0};
+
+    LatencyHistogram queueWait; // From queueing a job until it is handed to the service
+    LatencyHistogram translate; // From handing a job to the service until its callback
+    LatencyHistogram serialize; // Turning a message into JSON bytes
+    LatencyHistogram modelLoad;
+
+    QJsonObject toJson() const;
+
+    /**
+     * @brief Resident memory of this process in bytes, or -1 if unknown on
+     * this platform.
+     */
+    static qint64 residentMemory();
+};
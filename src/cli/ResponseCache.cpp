@@ -0,0 +1,56 @@
+#include "ResponseCache.h"
+
+ResponseCache::ResponseCache(std::size_t budget)
+: budget_(budget)
+, used_(0) {
+    //
+}
+
+QByteArray ResponseCache::get(QString const &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end())
+        return QByteArray();
+
+    // Move entry to the front of the list. Iterators stay valid with splice.
+    entries_.splice(entries_.begin(), entries_, it.value());
+    return entries_.front().payload; // Implicitly shared, no copy
+}
+
+void ResponseCache::insert(QString const &key, QByteArray const &payload) {
+    std::size_t size = static_cast<std::size_t>(payload.size());
+    if (size > budget_)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        used_ -= static_cast<std::size_t>(it.value()->payload.size());
+        entries_.erase(it.value());
+        index_.erase(it);
+    }
+
+    entries_.push_front(Entry{key, payload});
+    index_.insert(key, entries_.begin());
+    used_ += size;
+
+    while (used_ > budget_) {
+        Entry &oldest = entries_.back();
+        used_ -= static_cast<std::size_t>(oldest.payload.size());
+        index_.remove(oldest.key);
+        entries_.pop_back();
+    }
+}
+
+void ResponseCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    used_ = 0;
+}
+
+std::size_t ResponseCache::used() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <list>
+#include <mutex>
+
+/**
+ * LRU cache of serialized Translate responses, keyed by everything that
+ * determines the translation (see NativeMsgIface::flightKey()). It holds
+ * the compact JSON of the response's "data" object, so a repeated request is
+ * answered without touching the models, the service or the JSON serializer.
+ * Only the request id has to be filled in around it.
+ *
+ * Bounded by the total size of the cached payloads. Thread-safe: responses
+ * are inserted from the service's worker threads and looked up from the
+ * main thread.
+ */
+class ResponseCache {
+public:
+    explicit ResponseCache(std::size_t budget);
+
+    /**
+     * @brief Look up a payload and mark it as most recently used.
+     * @return the payload, or a null QByteArray if it is not cached.
+     */
+    QByteArray get(QString const &key);
+
+    /**
+     * @brief Add a payload. Evicts least recently used payloads until the
+     * cache fits its budget again. Payloads larger than the budget are not
+     * cached at all.
+     */
+    void insert(QString const &key, QByteArray const &payload);
+
+    /**
+     * @brief Drop everything, e.g. because the models changed.
+     */
+    void clear();
+
+    /**
+     * @brief Sum of the sizes of all cached payloads, in bytes.
+     */
+    std::size_t used() const;
+
+private:
+    struct Entry {
+        QString key;
+        QByteArray payload;
+    };
+
+    mutable std::mutex mutex_;
+    std::list<Entry> entries_; // Most recently used first
+    QHash<QString, std::list<Entry>::iterator> index_;
+    std::size_t budget_;
+    std::size_t used_;
+};
@@ -0,0 +1,210 @@
+#include "TranslationScheduler.h"
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+// How far down a session's queue to look for a job for the current models.
+const std::size_t kMaxAffinityLookahead = 64;
+
+} // Anonymous namespace
+
+TranslationScheduler::TranslationScheduler(std::size_t maxCostInFlight, std::size_t quantum, std::chrono::milliseconds maxAffinityDelay)
+: queued_(0)
+, queuedCost_(0)
+, sequence_(0)
+, maxCostInFlight_(maxCostInFlight)
+, quantum_(quantum)
+, maxAffinityDelay_(maxAffinityDelay)
+, costInFlight_(0) {
+    //
+}
+
+void TranslationScheduler::push(TranslationJob &&job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job.queued = TranslationJob::Clock::now();
+        Session &session = sessions_[job.session];
+        if (session.queue.empty())
+            turns_.push_back(job.session);
+        ++queued_;
+        queuedCost_ += job.cost;
+        session.queue.emplace(Key{-job.priority, sequence_++}, std::move(job));
+    }
+
+    dispatch();
+}
+
+void TranslationScheduler::done(std::size_t cost) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(costInFlight_ >= cost);
+        costInFlight_ -= cost;
+    }
+
+    dispatch();
+}
+
+std::size_t TranslationScheduler::cancel(std::int64_t requestID) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t dropped = 0;
+
+    // Linear, but cancelling is rare compared to pushing and popping.
+    for (auto &&entry : sessions_) {
+        auto &queue = entry.second.queue;
+        for (auto it = queue.begin(); it != queue.end();) {
+            if (it->second.requestID == requestID) {
+                queuedCost_ -= it->second.cost;
+                it = queue.erase(it);
+                ++dropped;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    queued_ -= dropped;
+    prune();
+    return dropped;
+}
+
+std::size_t TranslationScheduler::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_;
+}
+
+std::size_t TranslationScheduler::queuedCost() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queuedCost_;
+}
+
+std::vector<std::pair<std::string, std::size_t>> TranslationScheduler::queuedPerSession() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, std::size_t>> depths;
+    depths.reserve(turns_.size());
+    for (auto &&name : turns_)
+        depths.emplace_back(name, sessions_.at(name).queue.size());
+    return depths;
+}
+
+std::size_t TranslationScheduler::demand(std::string const &model) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t cost = 0;
+    for (auto &&entry : sessions_)
+        for (auto &&job : entry.second.queue)
+            if (std::find(job.second.models.begin(), job.second.models.end(), model) != job.second.models.end())
+                cost += job.second.cost;
+    return cost;
+}
+
+void TranslationScheduler::setWaitObserver(std::function<void(TranslationJob::Clock::duration)> observer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waitObserver_ = std::move(observer);
+}
+
+std::map<TranslationScheduler::Key, TranslationJob>::iterator TranslationScheduler::pick(Session &session) const {
+    auto head = session.queue.begin();
+
+    if (head->second.models == lastModels_)
+        return head;
+
+    // Don't let the job that is next in line wait too long.
+    if (TranslationJob::Clock::now() - head->second.queued > maxAffinityDelay_)
+        return head;
+
+    // Never skip ahead of more important work for affinity.
+    std::size_t lookahead = 0;
+    for (auto it = head; it != session.queue.end() && it->second.priority == head->second.priority && lookahead < kMaxAffinityLookahead; ++it, ++lookahead)
+        if (it->second.models == lastModels_)
+            return it;
+
+    return head;
+}
+
+std::pair<TranslationScheduler::Session *, std::map<TranslationScheduler::Key, TranslationJob>::iterator> TranslationScheduler::next() {
+    assert(!turns_.empty());
+
+    // Every pass around the table adds to each session's deficit, so this
+    // ends once some session saved up enough for the job it wants to submit.
+    for (;;) {
+        Session &session = sessions_.at(turns_.front());
+        auto it = pick(session);
+        if (it->second.cost <= session.deficit)
+            return {&session, it};
+
+        session.deficit += quantum_;
+        turns_.splice(turns_.end(), turns_, turns_.begin());
+    }
+}
+
+void TranslationScheduler::prune() {
+    for (auto it = turns_.begin(); it != turns_.end();) {
+        if (sessions_.at(*it).queue.empty()) {
+            sessions_.erase(*it);
+            it = turns_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TranslationScheduler::dispatch() {
+    // submit() can call done() on this thread, e.g. when the service answers
+    // straight from its cache. Instead of recursing, let the outer loop pick
+    // up the freed capacity.
+    static thread_local bool dispatching = false;
+    if (dispatching)
+        return;
+
+    dispatching = true;
+
+    for (;;) {
+        TranslationJob job;
+        bool expired;
+        std::function<void(TranslationJob::Clock::duration)> observer;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queued_ == 0)
+                break;
+
+            auto next = this->next();
+            Session &session = *next.first;
+            auto it = next.second;
+
+            // Always allow one job through if nothing is in flight, even if
+            // it is bigger than the limit on its own.
+            if (costInFlight_ > 0 && costInFlight_ + it->second.cost > maxCostInFlight_)
+                break;
+
+            job = std::move(it->second);
+            session.queue.erase(it);
+            session.deficit -= job.cost;
+            --queued_;
+            queuedCost_ -= job.cost;
+
+            // A session that ran out of work does not get to keep its savings.
+            if (session.queue.empty()) {
+                sessions_.erase(turns_.front());
+                turns_.pop_front();
+            }
+
+            observer = waitObserver_;
+            expired = job.deadline < TranslationJob::Clock::now();
+            if (!expired) {
+                costInFlight_ += job.cost;
+                lastModels_ = job.models;
+            }
+        }
+
+        if (observer)
+            observer(TranslationJob::Clock::now() - job.queued);
+
+        if (expired)
+            job.expired();
+        else
+            job.submit();
+    }
+
+    dispatching = false;
+}
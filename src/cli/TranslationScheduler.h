@@ -0,0 +1,135 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * A unit of translation work waiting to be handed to the translation service.
+ */
+struct TranslationJob {
+    using Clock = std::chrono::steady_clock;
+
+    std::int64_t requestID; // Native messaging request this job belongs to (see Request::key()), or the flight it serves. Used by cancel().
+    std::string session; // Jobs of different sessions share the service fairly
+    int priority{0}; // Higher is more important within a session
+    std::vector<std::string> models; // Ids of the models this job translates with, main model first
+    Clock::time_point deadline{Clock::time_point::max()};
+    Clock::time_point queued; // Set by push()
+    std::size_t cost{1}; // Estimate of the work, e.g. the number of words
+
+    // Hands the work to the service. The service callback has to call
+    // TranslationScheduler::done(cost) once the work is finished.
+    std::function<void()> submit;
+
+    // Called instead of submit() if the deadline passed while queued.
+    std::function<void()> expired;
+};
+
+/**
+ * Sits between NativeMsgIface and the translation service. Only a limited
+ * amount of work (measured in job cost) is handed to the service at a time,
+ * the rest waits here so that it can still be re-ordered by priority,
+ * cancelled or expired.
+ *
+ * Every session (e.g. a browser tab) has its own queue, ordered by priority
+ * and then arrival. Sessions take turns using deficit round robin: each turn
+ * a session earns `quantum` worth of cost it may submit, so a session that
+ * queued a whole book cannot starve one that asks for a single sentence.
+ *
+ * Within a session, jobs for the models that were used last go first, as
+ * long as the job that would otherwise be next has not waited longer than
+ * `maxAffinityDelay`. Consecutive work for the same model batches better
+ * than work that alternates between language pairs.
+ *
+ * Thread-safe: jobs are pushed from the main thread, and done() is called
+ * from the service's worker threads.
+ */
+class TranslationScheduler {
+public:
+    TranslationScheduler(std::size_t maxCostInFlight, std::size_t quantum, std::chrono::milliseconds maxAffinityDelay);
+
+    /**
+     * @brief queue a job and dispatch whatever fits in the service.
+     */
+    void push(TranslationJob &&job);
+
+    /**
+     * @brief a submitted job finished; frees up its cost and dispatches more.
+     */
+    void done(std::size_t cost);
+
+    /**
+     * @brief drops all queued jobs of a request. Jobs already submitted to
+     * the service are not affected.
+     * @return number of jobs dropped
+     */
+    std::size_t cancel(std::int64_t requestID);
+
+    /**
+     * @brief number of jobs waiting to be submitted.
+     */
+    std::size_t queued() const;
+
+    /**
+     * @brief number of jobs waiting to be submitted, per session that has any.
+     */
+    std::vector<std::pair<std::string, std::size_t>> queuedPerSession() const;
+
+    /**
+     * @brief total cost of the jobs waiting to be submitted.
+     */
+    std::size_t queuedCost() const;
+
+    /**
+     * @brief total cost of the queued jobs that use a model. Models with a lot
+     * of queued work are the worst to unload.
+     */
+    std::size_t demand(std::string const &model) const;
+
+    /**
+     * @brief called with how long each job waited in the queue before it
+     * was submitted. For statistics; must be thread-safe.
+     */
+    void setWaitObserver(std::function<void(TranslationJob::Clock::duration)> observer);
+
+private:
+    // Ordered by descending priority, then by arrival.
+    using Key = std::pair<int, std::uint64_t>;
+
+    struct Session {
+        std::map<Key, TranslationJob> queue;
+        std::size_t deficit{0};
+    };
+
+    // Submits jobs until the queue is empty or the in-flight limit is reached.
+    void dispatch();
+
+    // Session whose turn it is, and the job it gets to submit. Expects mutex_
+    // to be held and a non-empty queue.
+    std::pair<Session *, std::map<Key, TranslationJob>::iterator> next();
+
+    // Job of a session to submit next, taking model affinity into account.
+    std::map<Key, TranslationJob>::iterator pick(Session &session) const;
+
+    // Forgets about sessions without queued jobs. Expects mutex_ to be held.
+    void prune();
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Session> sessions_;
+    std::list<std::string> turns_; // Sessions with queued jobs, whose turn is first
+    std::size_t queued_;
+    std::size_t queuedCost_;
+    std::uint64_t sequence_;
+    std::size_t maxCostInFlight_;
+    std::size_t quantum_;
+    std::chrono::milliseconds maxAffinityDelay_;
+    std::size_t costInFlight_;
+    std::vector<std::string> lastModels_; // Models of the last submitted job
+    std::function<void(TranslationJob::Clock::duration)> waitObserver_;
+};
@@ -0,0 +1,439 @@
+#include "ArchiveExtractor.h"
+#include <QDir>
+// libarchive
+#include <archive.h>
+#include <archive_entry.h>
+
+namespace {
+    // How much of a file on disk the worker reads at once.
+    const qint64 kReadChunk = 1024 * 1024;
+
+    // Bytes written to disk between progress() signals, on top of one for
+    // every entry.
+    const qint64 kProgressInterval = 4 * 1024 * 1024;
+
+    /**
+     * Where an entry of the archive goes inside `root`. Returns false for
+     * entries that would end up outside of it, e.g. absolute paths or paths
+     * that go up with "..". Not normalised, because a trailing slash is what
+     * getCommonPrefixPath() in ModelManager needs to tell directories apart.
+     */
+    bool destinationPath(QDir const &root, char const *entry, QString &path) {
+        QString name = QFile::decodeName(entry);
+        if (name.isEmpty() || QDir::isAbsolutePath(name))
+            return false;
+
+        path = root.filePath(name);
+        QString cleaned = QDir::cleanPath(path);
+        return cleaned == root.path() || cleaned.startsWith(root.path() + "/");
+    }
+}
+
+QStringList const &ArchiveExtractor::supportedCompressions() {
+    static QStringList const compressions = [] {
+        QStringList compressions;
+        archive *a = archive_read_new();
+        // Anything but ARCHIVE_OK means libarchive would need to run the
+        // external program, or can't do it at all.
+#if ARCHIVE_VERSION_NUMBER >= 3003003
+        if (archive_read_support_filter_zstd(a) == ARCHIVE_OK)
+            compressions << "zstd";
+#endif
+        if (archive_read_support_filter_xz(a) == ARCHIVE_OK)
+            compressions << "xz";
+        if (archive_read_support_filter_gzip(a) == ARCHIVE_OK)
+            compressions << "gzip";
+        archive_read_free(a);
+        return compressions;
+    }();
+
+    return compressions;
+}
+
+ArchiveExtractor::ArchiveExtractor(QString const &templatePath, QObject *parent)
+: QIODevice(parent)
+, directory_(templatePath)
+, extracted_(false)
+, backlog_(0)
+, closed_(false)
+, cancelled_(false)
+, done_(false)
+, failed_(false) {
+    //
+}
+
+ArchiveExtractor::~ArchiveExtractor() {
+    // Nobody is listening any more to what the worker has to say.
+    disconnect(this, nullptr, nullptr, nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+    }
+    cv_.notify_one();
+
+    if (worker_.joinable())
+        worker_.join();
+}
+
+bool ArchiveExtractor::isSequential() const {
+    return true;
+}
+
+bool ArchiveExtractor::open(OpenMode mode) {
+    if (mode & ReadOnly) {
+        setErrorString(tr("Model archives can only be written to the extractor."));
+        return false;
+    }
+
+    if (!QIODevice::open(mode | Unbuffered))
+        return false;
+
+    if (!start()) {
+        QIODevice::close();
+        return false;
+    }
+
+    return true;
+}
+
+bool ArchiveExtractor::extractFile(QString const &path) {
+    source_.setFileName(path);
+    if (!source_.open(QIODevice::ReadOnly)) {
+        setErrorString(tr("Trouble while extracting language model after call to %1: %2").arg("QIODevice::open()", source_.errorString()));
+        return false;
+    }
+
+    // All of it is there already.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+
+    return start();
+}
+
+bool ArchiveExtractor::start() {
+    if (!directory_.isValid()) {
+        setErrorString(tr("Could not create temporary directory %1 to extract the model archive to.").arg(directory_.path()));
+        return false;
+    }
+
+    worker_ = std::thread(&ArchiveExtractor::extract, this);
+    return true;
+}
+
+void ArchiveExtractor::close() {
+    if (!isOpen())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    cv_.notify_one();
+
+    QIODevice::close();
+}
+
+void ArchiveExtractor::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+    }
+    cv_.notify_one();
+}
+
+qint64 ArchiveExtractor::bytesToWrite() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return backlog_;
+}
+
+bool ArchiveExtractor::isExtracted() const {
+    return extracted_;
+}
+
+bool ArchiveExtractor::succeeded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_ && !failed_;
+}
+
+bool ArchiveExtractor::failed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+bool ArchiveExtractor::cancelled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cancelled_;
+}
+
+QString ArchiveExtractor::errorMessage() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_)
+        return error_;
+    if (!done_)
+        return tr("The model archive is still being extracted.");
+    return QString();
+}
+
+QStringList ArchiveExtractor::files() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_;
+}
+
+QTemporaryDir &ArchiveExtractor::directory() {
+    return directory_;
+}
+
+qint64 ArchiveExtractor::readData(char *data, qint64 maxSize) {
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+qint64 ArchiveExtractor::writeData(char const *data, qint64 maxSize) {
+    if (failed()) {
+        setErrorString(errorMessage());
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // libarchive has seen the end of the archive. Whatever comes after it
+        // (padding, the gzip trailer) is still accepted so it gets hashed.
+        if (done_)
+            return maxSize;
+
+        queue_.emplace_back(data, maxSize);
+        backlog_ += maxSize;
+    }
+
+    cv_.notify_one();
+    return maxSize;
+}
+
+void ArchiveExtractor::finishExtraction() {
+    if (worker_.joinable())
+        worker_.join();
+
+    if (!succeeded())
+        setErrorString(errorMessage());
+
+    extracted_ = true;
+    emit extracted();
+}
+
+long long ArchiveExtractor::take(void const **buffer) {
+    if (source_.isOpen()) {
+        if (cancelled())
+            return -1;
+
+        current_ = source_.read(kReadChunk);
+        if (current_.isEmpty() && source_.error() != QFileDevice::NoError)
+            return -1;
+
+        *buffer = current_.constData();
+        return current_.size();
+    }
+
+    std::size_t size;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]{ return cancelled_ || closed_ || !queue_.empty(); });
+
+        if (cancelled_)
+            return -1;
+
+        if (queue_.empty())
+            return 0;
+
+        current_ = std::move(queue_.front());
+        queue_.pop_front();
+        size = current_.size();
+        backlog_ -= size;
+    }
+
+    emit bytesWritten(size);
+
+    *buffer = current_.constData();
+    return size;
+}
+
+void ArchiveExtractor::fail(QString const &message) {
+    std::size_t dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!failed_) {
+            failed_ = true;
+            error_ = cancelled_ ? tr("Extracting the model archive was cancelled.") : message;
+        }
+        done_ = true;
+        dropped = backlog_;
+        queue_.clear();
+        backlog_ = 0;
+    }
+
+    // Tell the writer there's room again, so it finds out.
+    if (dropped > 0)
+        emit bytesWritten(dropped);
+}
+
+// Adapted from https://github.com/libarchive/libarchive/blob/master/examples/untar.c#L136
+void ArchiveExtractor::extract() {
+    auto warning = [&](const char *f, const char *m) {
+        return tr("Trouble while extracting language model after call to %1: %2").arg(f, m);
+    };
+
+    qint64 entries = 0;
+    qint64 written = 0;
+    qint64 reported = 0;
+
+    auto copy_data = [&](struct archive *a_in, struct archive *a_out) {
+        const void *buff;
+        size_t size;
+#if ARCHIVE_VERSION_NUMBER >= 3000000
+        int64_t offset;
+#else
+        off_t offset;
+#endif
+
+        for (;;) {
+            // Big files would otherwise keep a cancelled extraction going.
+            if (cancelled()) {
+                fail(QString());
+                return ARCHIVE_FATAL;
+            }
+
+            int retval = archive_read_data_block(a_in, &buff, &size, &offset);
+            // End of archive: good!
+            if (retval == ARCHIVE_EOF)
+                return ARCHIVE_OK;
+
+            // Not end of archive: bad.
+            if (retval != ARCHIVE_OK) {
+                fail(warning("archive_read_data_block()", archive_error_string(a_in)));
+                return retval;
+            }
+
+            retval = archive_write_data_block(a_out, buff, size, offset);
+            if (retval != ARCHIVE_OK) {
+                fail(warning("archive_write_data_block()", archive_error_string(a_out)));
+                return retval;
+            }
+
+            written += size;
+            if (written - reported >= kProgressInterval) {
+                reported = written;
+                emit progress(archive_filter_bytes(a_in, -1), entries);
+            }
+        }
+    };
+
+    auto read = [](struct archive *, void *self, const void **buffer) -> la_ssize_t {
+        return static_cast<ArchiveExtractor *>(self)->take(buffer);
+    };
+
+    QDir root(directory_.path());
+
+    archive *a_in = archive_read_new();
+    archive *a_out = archive_write_disk_new();
+    // Entries are written to absolute paths inside root, so nothing here
+    // depends on the current directory of the process.
+    archive_write_disk_set_options(a_out, ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NODOTDOT | ARCHIVE_EXTRACT_SECURE_SYMLINKS);
+
+    // Whichever of these it is, libarchive figures out from the first bytes.
+    archive_read_support_format_tar(a_in);
+    archive_read_support_filter_gzip(a_in);
+    archive_read_support_filter_xz(a_in);
+#if ARCHIVE_VERSION_NUMBER >= 3003003
+    archive_read_support_filter_zstd(a_in);
+#endif
+
+    bool success = archive_read_open(a_in, this, nullptr, read, nullptr) == ARCHIVE_OK;
+    if (!success)
+        fail(warning("archive_read_open()", archive_error_string(a_in)));
+
+    // Read (and extract) all archive entries
+    while (success) {
+        archive_entry *entry;
+
+        int retval = archive_read_next_header(a_in, &entry);
+
+        // Stop when we read past the last entry
+        if (retval == ARCHIVE_EOF)
+            break;
+
+        if (retval < ARCHIVE_WARN) {
+            fail(warning("archive_read_next_header()", archive_error_string(a_in)));
+            success = false;
+            break;
+        }
+
+        QString path;
+        if (!destinationPath(root, archive_entry_pathname(entry), path)) {
+            fail(tr("The model archive contains a file outside of its own directory: %1").arg(archive_entry_pathname(entry)));
+            success = false;
+            break;
+        }
+        archive_entry_set_pathname(entry, QFile::encodeName(path).constData());
+
+        if (char const *link = archive_entry_hardlink(entry)) {
+            QString target;
+            if (!destinationPath(root, link, target)) {
+                fail(tr("The model archive contains a link to outside of its own directory: %1").arg(link));
+                success = false;
+                break;
+            }
+            archive_entry_set_hardlink(entry, QFile::encodeName(target).constData());
+        }
+
+        retval = archive_write_header(a_out, entry);
+        if (retval == ARCHIVE_OK) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                files_ << path;
+            }
+
+            if (archive_entry_size(entry) > 0 && copy_data(a_in, a_out) < ARCHIVE_WARN) {
+                success = false;
+                break;
+            }
+        }
+
+        retval = archive_write_finish_entry(a_out);
+        if (retval < ARCHIVE_WARN) {
+            fail(warning("archive_write_finish_entry()", archive_error_string(a_out)));
+            success = false;
+            break;
+        }
+
+        emit progress(archive_filter_bytes(a_in, -1), ++entries);
+    }
+
+    archive_read_close(a_in);
+    archive_read_free(a_in);
+
+    archive_write_close(a_out);
+    archive_write_free(a_out);
+
+    if (success) {
+        std::size_t dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            dropped = backlog_;
+            queue_.clear();
+            backlog_ = 0;
+        }
+
+        if (dropped > 0)
+            emit bytesWritten(dropped);
+    }
+
+    // Let the extractor's own thread join us and tell everyone.
+    QMetaObject::invokeMethod(this, "finishExtraction", Qt::QueuedConnection);
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/**
+ * Unpacks a tarball into a fresh temporary directory on a worker thread,
+ * either from a file on disk (extractFile()) or while it is being written to
+ * it as a device, so a model can be extracted while it is still downloading
+ * (see Network::downloadStream()).
+ *
+ * As a device, libarchive pulls whatever was written so far. bytesToWrite()
+ * is how much of that it hasn't taken yet, and bytesWritten() is emitted as it
+ * takes more. close() marks the end of the archive.
+ *
+ * Either way, extracted() is emitted once the worker is done, after which
+ * succeeded() and files() tell how it went. Nothing here depends on the
+ * working directory of the process, so any number of extractors can run at
+ * the same time.
+ *
+ * The temporary directory, and everything extracted into it, is removed
+ * together with the extractor unless you take it over through directory().
+ */
+class ArchiveExtractor : public QIODevice {
+    Q_OBJECT
+
+public:
+    /**
+     * @brief extracts into a new directory made from `templatePath` (see
+     * QTemporaryDir). Make sure it is on the same filesystem as where the
+     * files have to end up eventually, so they can be renamed there.
+     */
+    ArchiveExtractor(QString const &templatePath, QObject *parent = nullptr);
+    ~ArchiveExtractor();
+
+    bool isSequential() const override;
+    bool open(OpenMode mode) override;
+    void close() override;
+    qint64 bytesToWrite() const override;
+
+    /**
+     * @brief compressions of tarballs libarchive can unpack by itself (as
+     * opposed to through an external program), fastest to unpack first:
+     * "zstd", "xz", "gzip".
+     */
+    static QStringList const &supportedCompressions();
+
+    /**
+     * @brief extracts the archive at `path` instead of what is written to
+     * the device. Returns false if it can't be opened, see errorString().
+     */
+    bool extractFile(QString const &path);
+
+    /**
+     * @brief whether extracted() has been emitted.
+     */
+    bool isExtracted() const;
+
+    /**
+     * @brief whether the whole archive was extracted. Only meaningful once
+     * extracted() is emitted. errorString() tells what went wrong if not.
+     */
+    bool succeeded() const;
+
+    /**
+     * @brief absolute paths of everything extracted.
+     */
+    QStringList files() const;
+
+    QTemporaryDir &directory();
+
+public slots:
+    /**
+     * @brief stops extracting. extracted() follows, without success.
+     */
+    void cancel();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(char const *data, qint64 maxSize) override;
+
+private slots:
+    /**
+     * @brief the worker thread is done. Emits extracted() on the thread the
+     * extractor lives in.
+     */
+    void finishExtraction();
+
+private:
+    /**
+     * @brief starts the worker thread.
+     */
+    bool start();
+
+    /**
+     * @brief body of the worker thread.
+     */
+    void extract();
+
+    /**
+     * @brief for the archive_read_open() callback: takes the next chunk
+     * that was written, or reads it from the file, blocking until there is
+     * one. Returns 0 at the end of the archive, and -1 if the extraction was
+     * cancelled.
+     */
+    long long take(void const **buffer);
+
+    /**
+     * @brief gives up the worker thread's side, e.g. after an error.
+     */
+    void fail(QString const &message);
+
+    bool failed() const;
+    bool cancelled() const;
+    QString errorMessage() const;
+
+    QTemporaryDir directory_;
+    QFile source_; // Read by the worker when extracting a file
+    std::thread worker_;
+    bool extracted_; // Only touched on the extractor's own thread
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<QByteArray> queue_; // Written, not taken by libarchive yet
+    QByteArray current_; // Taken by libarchive, which may still point into it
+    std::size_t backlog_;
+    bool closed_; // No more will be written
+    bool cancelled_; // Stop as soon as possible
+    bool done_; // Worker is finished, with or without success
+    bool failed_;
+    QString error_;
+    QStringList files_;
+
+signals:
+    /**
+     * @brief emitted from the worker thread while extracting. `bytes` is how
+     * much of the archive itself is read, `entries` how many files and
+     * directories are extracted.
+     */
+    void progress(qint64 bytes, qint64 entries);
+
+    /**
+     * @brief the worker is done, successful or not.
+     */
+    void extracted();
+};
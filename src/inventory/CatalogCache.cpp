@@ -0,0 +1,103 @@
+#include "CatalogCache.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSaveFile>
+
+namespace {
+
+// Bump when the layout of the cache files changes. Older ones are ignored.
+const int kCacheVersion = 1;
+
+} // Anonymous namespace
+
+bool CatalogCache::Entry::isValid() const {
+    return !url.isEmpty();
+}
+
+CatalogCache::CatalogCache(QString directory)
+: directory_(std::move(directory)) {
+    //
+}
+
+QString CatalogCache::path(QString const &url) const {
+    return directory_.filePath(QString("%1.json").arg(QString(QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha1).toHex())));
+}
+
+CatalogCache::Entry CatalogCache::entry(QString const &url) const {
+    QFile file(path(url));
+    if (!file.open(QIODevice::ReadOnly))
+        return Entry(); // Never fetched
+
+    QJsonObject obj = QJsonDocument::fromJson(file.readAll()).object();
+    if (obj.value("version").toInt() != kCacheVersion || obj.value("url").toString() != url)
+        return Entry();
+
+    Entry entry;
+    entry.url = url;
+    entry.catalog = obj.value("catalog").toObject();
+    entry.etag = obj.value("etag").toString().toUtf8();
+    entry.lastModified = obj.value("lastModified").toString().toUtf8();
+    entry.checkedOn = QDateTime::fromString(obj.value("checkedOn").toString(), Qt::ISODate);
+    return entry;
+}
+
+void CatalogCache::addValidators(QNetworkRequest &request, QString const &url) const {
+    Entry cached = entry(url);
+    if (!cached.isValid())
+        return;
+
+    if (!cached.etag.isEmpty())
+        request.setRawHeader("If-None-Match", cached.etag);
+    if (!cached.lastModified.isEmpty())
+        request.setRawHeader("If-Modified-Since", cached.lastModified);
+}
+
+bool CatalogCache::store(QString const &url, QJsonObject const &catalog, QNetworkReply *reply) {
+    Entry entry;
+    entry.url = url;
+    entry.catalog = catalog;
+    entry.etag = reply->rawHeader("ETag");
+    entry.lastModified = reply->rawHeader("Last-Modified");
+    entry.checkedOn = QDateTime::currentDateTimeUtc();
+    return write(entry);
+}
+
+bool CatalogCache::touch(QString const &url) {
+    Entry cached = entry(url);
+    if (!cached.isValid())
+        return false;
+
+    cached.checkedOn = QDateTime::currentDateTimeUtc();
+    return write(cached);
+}
+
+bool CatalogCache::write(Entry const &entry) {
+    QDir().mkpath(directory_.absolutePath());
+
+    QSaveFile file(path(entry.url));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Could not cache repository catalog" << entry.url << ":" << file.errorString();
+        return false;
+    }
+
+    QJsonObject obj{
+        {"version", kCacheVersion},
+        {"url", entry.url},
+        {"etag", QString::fromUtf8(entry.etag)},
+        {"lastModified", QString::fromUtf8(entry.lastModified)},
+        {"checkedOn", entry.checkedOn.toString(Qt::ISODate)},
+        {"catalog", entry.catalog}
+    };
+
+    file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qDebug() << "Could not cache repository catalog" << entry.url << ":" << file.errorString();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <QByteArray>
+#include <QDateTime>
+#include <QDir>
+#include <QJsonObject>
+#include <QString>
+
+class QNetworkReply;
+class QNetworkRequest;
+
+/**
+ * Repository catalogs (the models.json of a repository) as they were last
+ * downloaded, so the list of available models is there right away when
+ * translateLocally starts, and checking a repository for changes can be a
+ * conditional request instead of downloading the whole catalog again.
+ *
+ * Every repository gets its own file in the cache directory, named after a
+ * hash of its url, holding the catalog together with the ETag and
+ * Last-Modified headers it came with.
+ */
+class CatalogCache {
+public:
+    struct Entry {
+        QString url;
+        QJsonObject catalog;
+        QByteArray etag;
+        QByteArray lastModified;
+        QDateTime checkedOn; // UTC, last time the server said this is current
+
+        bool isValid() const;
+    };
+
+    explicit CatalogCache(QString directory);
+
+    /**
+     * @brief the cached catalog of the repository at `url`. Invalid if there
+     * is none, or if it can't be read.
+     */
+    Entry entry(QString const &url) const;
+
+    /**
+     * @brief adds If-None-Match and If-Modified-Since to `request` for what we
+     * have of `url`, so the server can answer 304 Not Modified.
+     */
+    void addValidators(QNetworkRequest &request, QString const &url) const;
+
+    /**
+     * @brief stores a catalog the server sent in `reply`, with its ETag and
+     * Last-Modified headers.
+     */
+    bool store(QString const &url, QJsonObject const &catalog, QNetworkReply *reply);
+
+    /**
+     * @brief records that the server just confirmed (304 Not Modified) that
+     * what we have of `url` is current.
+     */
+    bool touch(QString const &url);
+
+private:
+    QString path(QString const &url) const;
+    bool write(Entry const &entry);
+
+    QDir directory_;
+};
@@ -0,0 +1,137 @@
+#include "ModelIndex.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#if defined(Q_OS_UNIX)
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+// Bump when the layout of the index changes. Older indexes are ignored.
+const int kIndexVersion = 1;
+
+} // Anonymous namespace
+
+ModelIndex::ModelIndex(QString path)
+: path_(std::move(path))
+, dirty_(false) {
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly))
+        return; // First run
+
+    QJsonObject index = QJsonDocument::fromJson(file.readAll()).object();
+    if (index.value("version").toInt() != kIndexVersion)
+        return;
+
+    listings_ = index.value("listings").toObject();
+    models_ = index.value("models").toObject();
+}
+
+QString ModelIndex::signature(QString const &path) {
+#if defined(Q_OS_UNIX)
+    // One stat() instead of the several QFileInfo would do, and it has the
+    // inode, which changes when a directory is replaced by another one.
+    struct stat info;
+    if (::stat(QFile::encodeName(path).constData(), &info) != 0)
+        return QString();
+
+#if defined(Q_OS_MACOS)
+    qint64 nsec = info.st_mtimespec.tv_nsec;
+#else
+    qint64 nsec = info.st_mtim.tv_nsec;
+#endif
+
+    return QString("%1.%2/%3/%4")
+        .arg(static_cast<qint64>(info.st_mtime))
+        .arg(nsec, 9, 10, QChar('0'))
+        .arg(static_cast<qint64>(info.st_size))
+        .arg(static_cast<quint64>(info.st_ino));
+#else
+    QFileInfo info(path);
+    if (!info.exists())
+        return QString();
+
+    return QString("%1/%2")
+        .arg(info.lastModified().toMSecsSinceEpoch())
+        .arg(info.size());
+#endif
+}
+
+bool ModelIndex::listing(QString const &dir, QString const &signature, QStringList &entries, QStringList &archives) {
+    QJsonObject listing = listings_.value(dir).toObject();
+    if (listing.isEmpty() || listing.value("signature").toString() != signature)
+        return false;
+
+    for (auto &&entry : listing.value("entries").toArray())
+        entries.append(entry.toString());
+    for (auto &&archive : listing.value("archives").toArray())
+        archives.append(archive.toString());
+
+    usedListings_.insert(dir, listing);
+    return true;
+}
+
+void ModelIndex::setListing(QString const &dir, QString const &signature, QStringList const &entries, QStringList const &archives) {
+    usedListings_.insert(dir, QJsonObject{
+        {"signature", signature},
+        {"entries", QJsonArray::fromStringList(entries)},
+        {"archives", QJsonArray::fromStringList(archives)}
+    });
+    dirty_ = true;
+}
+
+bool ModelIndex::model(QString const &dir, QString const &signature, QJsonObject &info, QJsonObject &meta) {
+    QJsonObject model = models_.value(dir).toObject();
+    if (model.isEmpty() || model.value("signature").toString() != signature)
+        return false;
+
+    info = model.value("info").toObject();
+    meta = model.value("meta").toObject();
+    usedModels_.insert(dir, model);
+    return true;
+}
+
+void ModelIndex::setModel(QString const &dir, QString const &signature, QJsonObject const &info, QJsonObject const &meta) {
+    usedModels_.insert(dir, QJsonObject{
+        {"signature", signature},
+        {"info", info},
+        {"meta", meta}
+    });
+    dirty_ = true;
+}
+
+bool ModelIndex::save() {
+    if (!dirty_)
+        return true;
+
+    QDir().mkpath(QFileInfo(path_).absolutePath());
+
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Could not write model index" << path_ << ":" << file.errorString();
+        return false;
+    }
+
+    QJsonObject index{
+        {"version", kIndexVersion},
+        {"listings", usedListings_},
+        {"models", usedModels_}
+    };
+
+    file.write(QJsonDocument(index).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qDebug() << "Could not write model index" << path_ << ":" << file.errorString();
+        return false;
+    }
+
+    listings_ = usedListings_;
+    models_ = usedModels_;
+    dirty_ = false;
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+/**
+ * On-disk cache of what ModelManager::scanForModels() found, so starting
+ * translateLocally (which browsers do for every native messaging connection)
+ * doesn't have to open and parse the json files of every installed model.
+ *
+ * It remembers the listing of every scanned directory, and the contents of
+ * model_info.json and modelMeta.json of every model directory. Each entry
+ * carries the signature() of the paths it was read from, and is only used
+ * while those still match. Anything that changed is read from disk again.
+ */
+class ModelIndex {
+public:
+    /**
+     * @brief reads the index from `path`. A missing or broken index is the
+     * same as an empty one.
+     */
+    explicit ModelIndex(QString path);
+
+    /**
+     * @brief modification time, size and inode of a file or directory, as a
+     * string that changes whenever any of those do. Empty if it doesn't exist.
+     */
+    static QString signature(QString const &path);
+
+    /**
+     * @brief entries (directories, absolute paths) and archives (file names)
+     * of a scanned directory, if its signature still matches.
+     */
+    bool listing(QString const &dir, QString const &signature, QStringList &entries, QStringList &archives);
+
+    void setListing(QString const &dir, QString const &signature, QStringList const &entries, QStringList const &archives);
+
+    /**
+     * @brief model_info.json and modelMeta.json of a directory, if its
+     * signature still matches. Either can be empty if the file is missing
+     * or broken.
+     */
+    bool model(QString const &dir, QString const &signature, QJsonObject &info, QJsonObject &meta);
+
+    void setModel(QString const &dir, QString const &signature, QJsonObject const &info, QJsonObject const &meta);
+
+    /**
+     * @brief writes the index if anything changed. Only keeps what was used
+     * since it was read, so directories that are gone are dropped.
+     */
+    bool save();
+
+private:
+    QString path_;
+    QJsonObject listings_; // As read from disk
+    QJsonObject models_;
+    QJsonObject usedListings_; // Looked up or set since
+    QJsonObject usedModels_;
+    bool dirty_;
+};
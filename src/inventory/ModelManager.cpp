@@ -1,4 +1,7 @@
 #include "ModelManager.h"
+#include "ArchiveExtractor.h"
+#include "ModelIndex.h"
+#include "ModelRouter.h"
 #include "Network.h"
 #include "types.h"
 #include <QApplication>
@@ -15,18 +18,24 @@
 #include <QJsonArray>
 #include <QNetworkReply>
 #include <QTemporaryDir>
+#include <QTimer>
 #include <QtGui>
 #include <QColor>
 #include <QStyle>
 #include <iostream>
-// libarchive
-#include <archive.h>
-#include <archive_entry.h>
 #include <algorithm>
 #include <optional>
 #include <variant>
 
 namespace {
+    // Seconds a model has to be busy translating before there is enough to
+    // go by for its speed, see ModelManager::recordSpeed().
+    const double kSpeedSampleSeconds = 10;
+
+    // Milliseconds measured speeds wait before they are saved, so the
+    // settings aren't written again for every measurement.
+    const int kSpeedSaveDelay = 5 * 60 * 1000;
+
     /**
      * Give it a QStringList with multiple paths, and this will return the
      * path prefix (i.e. the path to the shared root directory). Note: if only
@@ -55,15 +64,60 @@ namespace {
         return prefix.section("/", 0, -2);
     }
 
-    std::optional<Model> findModel(QList<Model> const &models, QString src, QString trg) {
-        std::optional<Model> found;
+    /**
+     * Name of a model archive without its extension(s), e.g. "enit.student.tiny11"
+     * for "enit.student.tiny11.tar.zst".
+     */
+    QString archiveBaseName(QString filename) {
+        for (char const *extension : {".tar.gz", ".tgz", ".tar.zst", ".tar.xz", ".txz"})
+            if (filename.endsWith(extension))
+                return filename.left(filename.size() - int(qstrlen(extension)));
+        return filename;
+    }
 
-        for (auto &&model : models) {
-            // Skip models that do not match src & trg
-            // @TODO deal with 'en' vs 'en-US'
-            if (!model.srcTags.contains(src) || model.trgTag != trg)
-                continue;
+    /**
+     * Repositories can list the same model compressed in several ways, next to
+     * the plain url and checksum of the .tar.gz:
+     *
+     *     "archives": [
+     *         {"compression": "zstd", "url": "...tar.zst", "checksum": "..."},
+     *         {"compression": "xz", "url": "...tar.xz", "checksum": "..."}
+     *     ]
+     *
+     * This picks the one that unpacks fastest of those we can unpack. Entries
+     * without a valid SHA-256 checksum are skipped: the download is only
+     * verified if there is a checksum to verify it against.
+     */
+    void selectArchive(QJsonObject const &obj, Model &model) {
+        QJsonArray archives = obj.value("archives").toArray();
+        if (archives.isEmpty())
+            return;
+
+        for (QString const &compression : ArchiveExtractor::supportedCompressions()) {
+            for (QJsonValue const &value : archives) {
+                QJsonObject archive = value.toObject();
+                if (archive.value("compression").toString() != compression || archive.value("url").toString().isEmpty())
+                    continue;
+
+                // fromHex() skips anything that isn't hex, hence the round trip.
+                QByteArray hex = archive.value("checksum").toString().toLatin1();
+                QByteArray checksum = QByteArray::fromHex(hex);
+                if (checksum.size() != 32 || checksum.toHex() != hex.toLower())
+                    continue;
+
+                model.url = archive.value("url").toString();
+                model.checksum = checksum;
+                return;
+            }
+        }
+    }
 
+    std::optional<Model> findModel(QList<Model> const &models, ModelLookup const &lookup, QString src, QString trg) {
+        std::optional<Model> found;
+
+        // @TODO deal with 'en' vs 'en-US'
+        for (int row : lookup.rowsWithLanguagePair(src, trg)) {
+            Model const &model = models[row];
             if (!found || (found->type != "tiny" && model.type == "tiny"))
                 found = model;
         }
@@ -72,9 +126,51 @@ namespace {
     }
 }
 
+void ModelLookup::clear() {
+    byId_.clear();
+    byPath_.clear();
+    byLanguagePair_.clear();
+}
+
+void ModelLookup::rebuild(QList<Model> const &models) {
+    clear();
+    byId_.reserve(models.size());
+    for (int row = 0; row < models.size(); ++row)
+        add(models[row], row);
+}
+
+void ModelLookup::add(Model const &model, int row) {
+    byId_[model.id()].append(row);
+
+    if (model.isLocal() && !byPath_.contains(model.path))
+        byPath_.insert(model.path, row);
+
+    for (auto it = model.srcTags.constBegin(); it != model.srcTags.constEnd(); ++it)
+        byLanguagePair_[qMakePair(it.key(), model.trgTag)].append(row);
+}
+
+QList<int> ModelLookup::rowsWithId(QString const &id) const {
+    return byId_.value(id);
+}
+
+int ModelLookup::rowWithId(QString const &id) const {
+    auto it = byId_.constFind(id);
+    return it != byId_.constEnd() ? it->first() : -1;
+}
+
+int ModelLookup::rowWithPath(QString const &path) const {
+    return byPath_.value(path, -1);
+}
+
+QList<int> ModelLookup::rowsWithLanguagePair(QString const &src, QString const &trg) const {
+    return byLanguagePair_.value(qMakePair(src, trg));
+}
+
 
 ModelManager::ModelManager(QObject *parent, Settings * settings)
     : QAbstractTableModel(parent)
+    , router_(std::make_unique<ModelRouter>())
+    , catalogs_(QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("catalogs"))
     , network_(new Network(this))
     , settings_(settings)
     , isFetchingRemoteModels_(false)
@@ -110,11 +206,30 @@ ModelManager::ModelManager(QObject *parent, Settings * settings)
         // We do clear the remoteModels list so that it is clear that it is
         // outdated and/or incomplete. Now users can click the "download model
         // list" again and make an informed decision to access the internet.
+        // What we have cached of the repositories that are still there can
+        // stay, as that doesn't need the internet.
         remoteModels_.clear();
+        remoteLookup_.clear();
+        catalogCheckedOn_.clear();
+        loadCachedCatalogs();
         updateAvailableModels();
     });
 
+    // Speeds the native messaging host measured in earlier sessions.
+    QVariantMap speeds = settings_->modelSpeeds();
+    for (auto it = speeds.constBegin(); it != speeds.constEnd(); ++it)
+        speeds_.insert(it.key(), it.value().toDouble());
+
     startupLoad();
+
+    // Only the catalogs of repositories the user fetched before are in the
+    // cache, so going online for these is nothing new.
+    QTimer::singleShot(0, this, &ModelManager::revalidateCatalogs);
+}
+
+ModelManager::~ModelManager() {
+    if (!unsavedSpeeds_.isEmpty())
+        saveSpeeds();
 }
 
 std::optional<Model> ModelManager::findModelForUpdate(Model const& model) {
@@ -149,24 +264,24 @@ bool ModelManager::validateModel(QString path) {
 }
 
 std::optional<Model> ModelManager::getModel(QString const &id) const {
-    for (auto &&model : getInstalledModels())
-        if (model.id() == id)
-            return model;
+    int row = localLookup_.rowWithId(id);
+    if (row != -1)
+        return localModels_[row];
 
-    for (auto &&model : getRemoteModels())
-        if (model.id() == id)
-            return model;
+    row = remoteLookup_.rowWithId(id);
+    if (row != -1)
+        return remoteModels_[row];
 
     return std::nullopt;
 }
 
 std::optional<Model> ModelManager::getModelForLanguagePair(QString src, QString trg) const {
     // First search the already installed models.
-    std::optional<Model> found(findModel(getInstalledModels(), src, trg));
+    std::optional<Model> found(findModel(localModels_, localLookup_, src, trg));
     
     // Did we find an installed model? If not, search the remote models
     if (!found)
-        found = findModel(getRemoteModels(), src, trg);
+        found = findModel(remoteModels_, remoteLookup_, src, trg);
 
     return found;
 }
@@ -183,27 +298,130 @@ std::optional<ModelPair> ModelManager::getModelPairForLanguagePair(QString src,
     return ModelPair{*sourceModel, *pivotModel};
 }
 
-std::optional<Model> ModelManager::writeModel(QFile *file, ModelMeta meta, QString filename) {
-    // Default value for filename is the basename of the file.
-    if (filename.isEmpty())
-        filename = QFileInfo(*file).fileName();
+std::optional<ModelRoute> ModelManager::getRoute(QString const &src, QString const &trg, translateLocally::models::RoutePolicy policy) const {
+    return router_->route(src, trg, policy);
+}
+
+void ModelManager::recordSpeed(Model const &model, std::size_t words, double seconds) {
+    if (words < kMinSpeedSampleWords || seconds <= 0 || localLookup_.rowWithId(model.id()) == -1)
+        return;
+
+    // Added up first, so the overhead of a single translation or a moment
+    // the machine was busy with something else doesn't throw it off.
+    SpeedSample &sample = speedSamples_[model.id()];
+    sample.words += words;
+    sample.seconds += seconds;
+    if (sample.seconds < kSpeedSampleSeconds)
+        return;
+
+    double wordsPerSecond = sample.words / sample.seconds;
+    speedSamples_.remove(model.id());
+
+    // And averaged over time.
+    double &speed = speeds_[model.id()];
+    speed = speed > 0 ? 0.8 * speed + 0.2 * wordsPerSecond : wordsPerSecond;
+
+    // Only changes big enough to change the routes are worth acting on.
+    if (!router_->isOutdated(model.id(), speed))
+        return;
+
+    updateRoutes();
+
+    if (unsavedSpeeds_.isEmpty())
+        QTimer::singleShot(kSpeedSaveDelay, this, &ModelManager::saveSpeeds);
+    unsavedSpeeds_.insert(model.id());
+}
 
+void ModelManager::saveSpeeds() {
+    // Only the ones measured here, as other processes measure too.
+    QVariantMap speeds = settings_->modelSpeeds();
+    for (QString const &id : unsavedSpeeds_)
+        speeds.insert(id, speeds_.value(id));
+    settings_->modelSpeeds.setValue(speeds);
+    unsavedSpeeds_.clear();
+}
+
+void ModelManager::updateRoutes() {
+    router_->rebuild(localModels_, speeds_);
+}
+
+ArchiveExtractor *ModelManager::importModel(QString path, ModelMeta meta, QVariant extradata) {
     // Initially extract to to a temporary directory. Will delete its contents
     // when it goes out of scope. Creating a temporary directory specifically
     // inside the target directory to make sure we're on the same filesystem.
     // Otherwise `QDir::rename()` might fail. Note that directories starting
     // with "extracting-" are explicitly skipped `scanForModels()`.
-    QTemporaryDir tempDir(appDataDir_.filePath("extracting-XXXXXXX"));
-    if (!tempDir.isValid()) {
-        emit error(tr("Could not create temporary directory in %1 to extract the model archive to.").arg(appDataDir_.path()));
-        return std::nullopt;
+    ArchiveExtractor *extractor = new ArchiveExtractor(appDataDir_.filePath("extracting-XXXXXXX"));
+    if (!extractor->extractFile(path)) {
+        emit error(extractor->errorString());
+        emit installFailed(extractor->errorString(), extradata);
+        delete extractor;
+        return nullptr;
     }
 
-    // Try to extract the archive to the temporary directory
-    QStringList extracted;
-    if (!extractTarGz(file, tempDir.path(), extracted))
-        return std::nullopt;
+    installWhenExtracted(extractor, meta, QFileInfo(path).fileName(), extradata);
+    return extractor;
+}
+
+SegmentedDownload *ModelManager::downloadModel(Network *network, Model const &model, QVariant extradata) {
+    // Same as importModel(), extract inside the target directory so the final
+    // rename stays on the same filesystem.
+    ArchiveExtractor *extractor = new ArchiveExtractor(appDataDir_.filePath("extracting-XXXXXXX"));
+
+    // Downloads that were interrupted continue from here the next time.
+    QDir downloads(QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("downloads"));
+    QString partialPath = downloads.filePath(QString("%1.part").arg(QString(QCryptographicHash::hash(model.url.toUtf8(), QCryptographicHash::Sha1).toHex())));
+
+    SegmentedDownload *download = network->downloadStream(model.url, extractor, partialPath, QCryptographicHash::Sha256, model.checksum, extradata);
+
+    // Extracted files live as long as the download itself, unless
+    // installModel() takes them over.
+    if (download != nullptr)
+        extractor->setParent(download);
+    else
+        delete extractor;
+
+    return download;
+}
+
+void ModelManager::installModel(QIODevice *download, ModelMeta meta, QString filename, QVariant extradata) {
+    ArchiveExtractor *extractor = qobject_cast<ArchiveExtractor*>(download);
+    Q_ASSERT(extractor != nullptr); // Should come from downloadModel()
+
+    // The checksum matched, or we'd not be here. The extractor might still
+    // be busy with the last of it though.
+    installWhenExtracted(extractor, meta, filename, extradata);
+}
+
+void ModelManager::installWhenExtracted(ArchiveExtractor *extractor, ModelMeta meta, QString filename, QVariant extradata) {
+    // It's ours now, and gone once it is installed.
+    extractor->setParent(this);
+
+    auto install = [=] {
+        std::optional<Model> model;
+
+        if (extractor->succeeded())
+            model = installExtractedModel(extractor->directory(), extractor->files(), meta, filename);
+        else
+            emit error(extractor->errorString());
+
+        if (model)
+            emit modelInstalled(*model, extradata);
+        else if (extractor->succeeded()) // The details went to error()
+            emit installFailed(tr("Could not install %1.").arg(filename), extradata);
+        else
+            emit installFailed(extractor->errorString(), extradata);
+
+        extractor->deleteLater();
+    };
 
+    if (extractor->isExtracted())
+        install();
+    else
+        connect(extractor, &ArchiveExtractor::extracted, this, install);
+}
+
+std::optional<Model> ModelManager::installExtractedModel(QTemporaryDir &tempDir, QStringList const &extracted, ModelMeta meta, QString filename) {
     // Assert we extracted at least something.
     if (extracted.isEmpty()) {
         emit error(tr("Did not extract any files from the model archive."));
@@ -219,7 +437,7 @@ std::optional<Model> ModelManager::writeModel(QFile *file, ModelMeta meta, QStri
     }
 
     // Assume the prefix is at least tempDir. If not, something shady is
-    // happening, like the tar.gz file writing to an absolute path?
+    // happening, like the archive writing to an absolute path?
     Q_ASSERT(prefix.startsWith(tempDir.path()));
 
     // Try determining whether the model is any good before we continue to safe
@@ -227,9 +445,13 @@ std::optional<Model> ModelManager::writeModel(QFile *file, ModelMeta meta, QStri
     if (!validateModel(prefix)) // validateModel emits its own error() signals (hence validateModel and not isModelValid)
         return std::nullopt;
 
-    QString newModelDirName = QString("%1-%2").arg(filename.split(".tar.gz")[0]).arg(QDateTime::currentMSecsSinceEpoch() / 1000);
+    QString newModelDirName = QString("%1-%2").arg(archiveBaseName(filename)).arg(QDateTime::currentMSecsSinceEpoch() / 1000);
     QString newModelDirPath = appDataDir_.absoluteFilePath(newModelDirName);
 
+    // Installs can run side by side, and might be of the same archive.
+    for (int n = 2; QFileInfo::exists(newModelDirPath); ++n)
+        newModelDirPath = appDataDir_.absoluteFilePath(QString("%1-%2").arg(newModelDirName).arg(n));
+
     if (!QDir().rename(prefix, newModelDirPath)) {
         emit error(tr("Could not move extracted model from %1 to %2.").arg(tempDir.path(), newModelDirPath));
         return std::nullopt;
@@ -257,12 +479,12 @@ std::optional<Model> ModelManager::writeModel(QFile *file, ModelMeta meta, QStri
     // Upgrade behaviour: remove any older versions of this model. At least if
     // the older model is part of the models managed by us. We don't delete
     // models from the CWD.
-    // Note: Right now there's no check on version. We assume that if writeModel
-    // is called, it either was called from the upgrade path, or the user
+    // Note: Right now there's no check on version. We assume that if a model
+    // is installed, it either came from the upgrade path, or the user
     // intentionally installing an older model through the model manager UI.
-    for (auto &&installed : localModels_)
-        if (installed.isSameModel(*model) && isManagedModel(installed))
-            removeModel(installed);
+    int row = localLookup_.rowWithId(model->id());
+    if (row != -1 && isManagedModel(localModels_[row]))
+        removeModel(Model(localModels_[row])); // Copy, as it's removed from the list
 
     insertLocalModel(*model);
     updateAvailableModels();
@@ -290,41 +512,69 @@ bool ModelManager::removeModel(Model const &model) {
         // should also remove the model from localModels_
     }
 
-    int position = localModels_.indexOf(model);
+    int position = -1;
+    for (int row : localLookup_.rowsWithId(model.id())) {
+        if (localModels_[row] == model) {
+            position = row;
+            break;
+        }
+    }
 
     if (position == -1)
         return false;
 
     beginRemoveRows(QModelIndex(), position, position);
-    localModels_.removeOne(model);
+    localModels_.removeAt(position);
+    localLookup_.rebuild(localModels_);
     endRemoveRows();
     updateAvailableModels();
     return true;
 }
 
 bool ModelManager::insertLocalModel(Model model) {
-    int position = 0;
-
-    for (int i = 0; i < localModels_.size(); ++i) {
-        // First, make sure we don't already have this model
-        if (localModels_[i].isSameModel(model)) {
-            localModels_[i] = model;
-            emit dataChanged(index(i, 0), index(i, columnCount()));
-            return false;
-        }
-
-        // Second, while we're iterating anyway, figure out where to insert
-        // this model.
-        if (localModels_[i] < model)
-            position = i + 1;
+    // First, make sure we don't already have this model
+    int existing = localLookup_.rowWithId(model.id());
+    if (existing != -1) {
+        localModels_[existing] = model;
+        localLookup_.rebuild(localModels_); // Path might have changed
+        emit dataChanged(index(existing, 0), index(existing, columnCount()));
+        return false;
     }
 
+    // Insert after all models that sort before or together with it.
+    int position = std::upper_bound(localModels_.begin(), localModels_.end(), model) - localModels_.begin();
+
     beginInsertRows(QModelIndex(), position, position);
     localModels_.insert(position, model);
+    localLookup_.rebuild(localModels_);
     endInsertRows();
     return true;
 }
 
+void ModelManager::insertLocalModels(QList<Model> const &models) {
+    if (models.isEmpty())
+        return;
+
+    beginResetModel();
+
+    for (auto &&model : models) {
+        int existing = localLookup_.rowWithId(model.id());
+        if (existing != -1) {
+            localModels_[existing] = model;
+        } else {
+            localLookup_.add(model, localModels_.size());
+            localModels_.append(model);
+        }
+    }
+
+    // Stable, so models that sort the same stay in the order they were found,
+    // same as inserting them one by one.
+    std::stable_sort(localModels_.begin(), localModels_.end());
+    localLookup_.rebuild(localModels_);
+
+    endResetModel();
+}
+
 QJsonObject ModelManager::getModelInfoJsonFromDir(QString dir, QString *error) {
     // Check if we can find a model_info.json in the directory. If so, record it as part of the model
     QFileInfo modelInfo(dir + "/model_info.json");
@@ -423,55 +673,84 @@ std::optional<Model> ModelManager::parseModelInfo(QJsonObject& obj, translateLoc
     return std::make_optional(model);
 }
 
-void ModelManager::scanForModels(QString path) {
+void ModelManager::scanForModels(QString path, ModelIndex &index) {
     //Iterate over all files in the folder and take note of available models and archives
     //@TODO currently, archives can only be extracted from the config dir
-    QDirIterator it(path, QDir::NoFilter);
-    while (it.hasNext()) {
-        QString current = it.next();
-        QFileInfo f(current);
-        if (f.isDir()) {
-            // Skip temporary directories created by `writeModel()`.
-            if (f.baseName().startsWith("extracting-"))
-                continue;
-
-            // Possible parse error, useful for debugging
-            QString errorMsg;
-
-            QJsonObject obj = getModelInfoJsonFromDir(current, &errorMsg);
-            
-            // We have a folder in our models directory that doesn't contain a model. This is ok.
-            if (obj.empty())
-                continue;
-
-            auto model = parseModelInfo(obj, translateLocally::models::Local, &errorMsg);
-            if (!model) {
-                emit error(tr("Invalid json file: %1/model_info.json: %2").arg(current, errorMsg));
-                continue;
+    QStringList entries;
+    QStringList archives;
+
+    // Listing the directory is only necessary if something was added or
+    // removed since the last time.
+    QString signature = ModelIndex::signature(path);
+    if (!index.listing(path, signature, entries, archives)) {
+        QDirIterator it(path, QDir::NoFilter);
+        while (it.hasNext()) {
+            QString current = it.next();
+            QFileInfo f(current);
+            if (f.isDir()) {
+                // Skip temporary directories created by `importModel()` and `downloadModel()`.
+                if (!f.baseName().startsWith("extracting-"))
+                    entries.append(current);
+            } else {
+                // Check if this an existing archive
+                if (f.completeSuffix() == QString("tar.gz")) {
+                    archives.append(f.fileName());
+                }
             }
+        }
 
-            model->path = current;
+        index.setListing(path, signature, entries, archives);
+    }
 
-            readModelMetaFromDir(*model, current);
-            
-            insertLocalModel(*model);
-        } else {
-            // Check if this an existing archive
-            if (f.completeSuffix() == QString("tar.gz")) {
-                archives_.append(f.fileName());
-            }
+    archives_.append(archives);
+
+    QList<Model> found;
+
+    for (auto &&current : entries) {
+        // Possible parse error, useful for debugging
+        QString errorMsg;
+
+        QJsonObject obj;
+        QJsonObject meta;
+
+        // Only read the json files of models that changed.
+        QString modelSignature = ModelIndex::signature(current)
+            + '|' + ModelIndex::signature(current + "/model_info.json")
+            + '|' + ModelIndex::signature(current + "/modelMeta.json");
+        if (!index.model(current, modelSignature, obj, meta)) {
+            obj = getModelInfoJsonFromDir(current, &errorMsg);
+            if (!obj.empty())
+                meta = getModelMetaJsonFromDir(current);
+            index.setModel(current, modelSignature, obj, meta);
+        }
+
+        // We have a folder in our models directory that doesn't contain a model. This is ok.
+        if (obj.empty())
+            continue;
+
+        auto model = parseModelInfo(obj, translateLocally::models::Local, &errorMsg);
+        if (!model) {
+            emit error(tr("Invalid json file: %1/model_info.json: %2").arg(current, errorMsg));
+            continue;
         }
+
+        model->path = current;
+
+        applyModelMeta(*model, meta);
+        
+        found.append(std::move(*model));
     }
 
+    insertLocalModels(found);
     updateAvailableModels();
 }
 
-bool ModelManager::readModelMetaFromDir(ModelMeta &model, QString dir) const {
+QJsonObject ModelManager::getModelMetaJsonFromDir(QString dir) const {
     QFile metaFile(dir + "/modelMeta.json");
     if (!metaFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
         qDebug() << "Could not parse model meta file" << metaFile.fileName() << ": file cannot be opened for reading.\n"
                  << "The model is either in the current working directory or downloaded before metadata was added to translateLocally.";
-        return false; // Cannot open file, might not exist
+        return QJsonObject(); // Cannot open file, might not exist
     }
     
     QByteArray bytes = metaFile.readAll();
@@ -482,14 +761,28 @@ bool ModelManager::readModelMetaFromDir(ModelMeta &model, QString dir) const {
     QJsonDocument json = QJsonDocument::fromJson(bytes, &error);
     if (json.isNull()) {
         qDebug() << "Could not parse model meta file" << metaFile.fileName() << ":" << error.errorString();
-        return false; // Broken meta file, probably 
+        return QJsonObject(); // Broken meta file, probably 
     }
     
-    QJsonObject obj = json.object();
+    return json.object();
+}
+
+bool ModelManager::readModelMetaFromDir(ModelMeta &model, QString dir) const {
+    QJsonObject obj = getModelMetaJsonFromDir(dir);
+    if (obj.isEmpty())
+        return false;
+
+    applyModelMeta(model, obj);
+    return true;
+}
+
+void ModelManager::applyModelMeta(ModelMeta &model, QJsonObject const &obj) const {
+    if (obj.isEmpty())
+        return;
+
     model.modelUrl = obj.value("modelUrl").toString();
     model.repositoryUrl = obj.value("repositoryUrl").toString();
     model.installedOn = QDateTime::fromString(obj.value("installedOn").toString(), Qt::ISODate);
-    return true;
 }
 
 bool ModelManager::writeModelMetaToDir(ModelMeta const &model, QString dir) const {
@@ -512,176 +805,149 @@ bool ModelManager::writeModelMetaToDir(ModelMeta const &model, QString dir) cons
 }
 
 void ModelManager::startupLoad() {
+    // What we found last time. Kept out of the directories we scan, so
+    // writing it doesn't make them look changed.
+    ModelIndex index(QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("model_index.json"));
+
     // Scan for shared models installed through the system package manager.
     // Those paths should only contain already-extracted models.
     // They should be considered read-only.
     for (const auto &sharedDir : QStandardPaths::locateAll(QStandardPaths::AppDataLocation, QString("models"), QStandardPaths::LocateDirectory)) {
-        scanForModels(sharedDir);
+        scanForModels(sharedDir, index);
     }
 
     // Iterate over all files in the app's data folder and take note of available models and archives
-    scanForModels(appDataDir_.absolutePath());
+    scanForModels(appDataDir_.absolutePath(), index);
     // Also scan for models located in the app's config directory in previous versions
-    scanForModels(QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation));
-    scanForModels(QDir::current().path()); // Scan the current directory for models. @TODO archives found in this folder would not be used
+    scanForModels(QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation), index);
+    scanForModels(QDir::current().path(), index); // Scan the current directory for models. @TODO archives found in this folder would not be used
+
+    index.save();
+
+    loadCachedCatalogs();
 }
 
-// Adapted from https://github.com/libarchive/libarchive/blob/master/examples/untar.c#L136
-bool ModelManager::extractTarGz(QFile *file, QDir const &destination, QStringList &files) {
-    // Change current working directory while extracting
-    QString currentPath = QDir::currentPath();
+void ModelManager::loadCachedCatalogs() {
+    for (QString const &url : settings_->repos().keys()) {
+        CatalogCache::Entry cached = catalogs_.entry(url);
+        if (!cached.isValid())
+            continue;
 
-    if (!QDir::setCurrent(destination.absolutePath())) {
-        emit error(tr("Failed to change path to the configuration directory %1. %2 won't be extracted.").arg(destination.absolutePath(), file->fileName()));
-        return false;
+        if (parseRemoteModels(cached.catalog, url))
+            catalogCheckedOn_.insert(url, cached.checkedOn);
     }
+}
 
-    QStringList extracted;
-    bool success = extractTarGzInCurrentPath(file, extracted);
-
-    for (QString const &file : qAsConst(extracted))
-        files << destination.filePath(file);
+bool ModelManager::isCatalogFresh(QString const &url) const {
+    auto it = catalogCheckedOn_.constFind(url);
+    return it != catalogCheckedOn_.constEnd()
+        && it->isValid()
+        && it->secsTo(QDateTime::currentDateTimeUtc()) < qint64(settings_->catalogMaxAge()) * 60;
+}
 
-    QDir::setCurrent(currentPath);
-    return success;
+void ModelManager::revalidateCatalogs() {
+    for (QString const &url : catalogCheckedOn_.keys())
+        if (!isCatalogFresh(url))
+            fetchCatalog(url);
 }
 
-bool ModelManager::extractTarGzInCurrentPath(QFile *file, QStringList &files) {
-    auto warn = [&](const char *f, const char *m) {
-        emit error(tr("Trouble while extracting language model after call to %1: %2").arg(f, m));
-    };
+QNetworkReply *ModelManager::fetchCatalog(QString const &url) {
+    if (QNetworkReply *pending = catalogReplies_.value(url))
+        return pending;
 
-    auto copy_data = [=](struct archive *a_in, struct archive *a_out) {
-        const void *buff;
-        size_t size;
-#if ARCHIVE_VERSION_NUMBER >= 3000000
-        int64_t offset;
-#else
-        off_t offset;
-#endif
-
-        for (;;) {
-            int retval = archive_read_data_block(a_in, &buff, &size, &offset);
-            // End of archive: good!
-            if (retval == ARCHIVE_EOF)
-                return ARCHIVE_OK;
-            
-            // Not end of archive: bad.
-            if (retval != ARCHIVE_OK) {
-                warn("archive_read_data_block()", archive_error_string(a_in));
-                return retval;
-            }
-            
-            retval = archive_write_data_block(a_out, buff, size, offset);
-            if (retval != ARCHIVE_OK) {
-                warn("archive_write_data_block()", archive_error_string(a_out));
-                return retval;
-            }
-        }
-    };
+    QNetworkRequest request(url);
 
-    archive *a_in = archive_read_new();
-    archive *a_out = archive_write_disk_new();
-    archive_write_disk_set_options(a_out, ARCHIVE_EXTRACT_TIME);
-    
-    archive_read_support_format_tar(a_in);
-    archive_read_support_filter_gzip(a_in);
-    
-    if (!file->open(QIODevice::ReadOnly)) {
-        emit error(tr("Trouble while extracting language model after call to %1: %2").arg("QIODevice::open()", file->errorString()));
-        return false;
-    }
-    
-    if (archive_read_open_fd(a_in, file->handle(), 10240)) {
-        warn("archive_read_open_filename()", archive_error_string(a_in));
-        return false;
-    }
+    // Only ask whether it changed if what we have is what's in use.
+    if (catalogCheckedOn_.contains(url))
+        catalogs_.addValidators(request, url);
 
-    // Read (and extract) all archive entries
-    for (;;) {
-        archive_entry *entry;
-        
-        int retval = archive_read_next_header(a_in, &entry);
+    QNetworkReply *reply = network_->get(request);
+    catalogReplies_.insert(url, reply);
 
-        // Stop when we read past the last entry
-        if (retval == ARCHIVE_EOF)
-            break;
+    connect(reply, &QNetworkReply::finished, this, [=] {
+        catalogReplies_.remove(url);
+        reply->deleteLater();
 
-        if (retval < ARCHIVE_OK)
-            warn("archive_read_next_header()", archive_error_string(a_in));
-        if (retval < ARCHIVE_WARN)
-            return false;
+        // Repository was removed in the meantime, or the request failed.
+        if (!settings_->repos().contains(url) || reply->error() != QNetworkReply::NoError)
+            return;
 
-        retval = archive_write_header(a_out, entry);
-        if (retval < ARCHIVE_OK)
-            warn("archive_write_header()", archive_error_string(a_out));
-        else {
-            files << QString(archive_entry_pathname(entry));
+        if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304) {
+            catalogs_.touch(url);
+            catalogCheckedOn_[url] = QDateTime::currentDateTimeUtc();
+            return;
+        }
 
-            if(archive_entry_size(entry) > 0)
-                if (copy_data(a_in, a_out) < ARCHIVE_WARN)
-                    return false;
+        QJsonObject catalog = QJsonDocument::fromJson(reply->readAll()).object();
+        if (parseRemoteModels(catalog, url)) {
+            catalogs_.store(url, catalog, reply);
+            catalogCheckedOn_[url] = QDateTime::currentDateTimeUtc();
+        } else {
+            catalogCheckedOn_.remove(url);
         }
+    });
 
-        retval = archive_write_finish_entry(a_out);
-        if (retval < ARCHIVE_OK)
-            warn("archive_write_finish_entry()", archive_error_string(a_out));
-        if (retval < ARCHIVE_WARN)
-            return false;
-    }
+    return reply;
+}
 
-    archive_read_close(a_in);
-    archive_read_free(a_in);
+void ModelManager::fetchRemoteModels(QVariant extradata) {
+    QStringList stale;
+    for (QString const &url : settings_->repos().keys())
+        if (!isCatalogFresh(url))
+            stale.append(url);
 
-    archive_write_close(a_out);
-    archive_write_free(a_out);
+    fetchCatalogs(stale, extradata);
+}
 
-    return true;
+void ModelManager::refreshRemoteModels(QVariant extradata) {
+    fetchCatalogs(settings_->repos().keys(), extradata);
 }
 
-void ModelManager::fetchRemoteModels(QVariant extradata) {
+void ModelManager::fetchCatalogs(QStringList const &urls, QVariant extradata) {
     if (isFetchingRemoteModels())
         return;
 
-    auto repos = settings_->repos();
-    QSharedPointer<int> num_repos(new int(repos.size())); // Keep track of how many repos have been fetched
-    for (QString url : repos.keys()) {
-        isFetchingRemoteModels_ = true;
-        emit fetchingRemoteModels();
+    isFetchingRemoteModels_ = true;
+    emit fetchingRemoteModels();
 
-        QNetworkRequest request(url);
-        QNetworkReply *reply = network_->get(request);
+    // Everything we have is recent enough, no need to go online. Still finish
+    // from the event loop, as callers expect when they wait for it.
+    if (urls.isEmpty()) {
+        QTimer::singleShot(0, this, [=] {
+            isFetchingRemoteModels_ = false;
+            emit fetchedRemoteModels(extradata);
+        });
+        return;
+    }
+
+    QSharedPointer<int> num_repos(new int(urls.size())); // Keep track of how many repos have been fetched
+    for (QString const &url : urls) {
+        // fetchCatalog() connected first, so the catalog is in use by the
+        // time this runs.
+        QNetworkReply *reply = fetchCatalog(url);
         connect(reply, &QNetworkReply::finished, this, [=] {
-            switch (reply->error()) {
-                case QNetworkReply::NoError:
-                    parseRemoteModels(QJsonDocument::fromJson(reply->readAll()).object(), url);
-                    break;
-                default:
-                    QString errstr = QString("Error fetching remote repository: ") + url +
-                            QString("\nError code: ") + reply->errorString() +
-                            QString("\nPlease double check that the address is reachable.");
-                    emit error(errstr);
-                    break;
+            if (reply->error() != QNetworkReply::NoError) {
+                QString errstr = QString("Error fetching remote repository: ") + url +
+                        QString("\nError code: ") + reply->errorString() +
+                        QString("\nPlease double check that the address is reachable.");
+                emit error(errstr);
             }
             if (--(*num_repos) == 0) { // Once we have fetched all repositories, re-enable fetch.
                 isFetchingRemoteModels_ = false;
                 emit fetchedRemoteModels(extradata);
             }
-
-            reply->deleteLater();
         });
     }
 }
 
-void ModelManager::parseRemoteModels(QJsonObject obj, QString repositoryUrl) {
+bool ModelManager::parseRemoteModels(QJsonObject obj, QString repositoryUrl) {
     using namespace translateLocally::models;
-    
+
+    QList<Model> parsed;
     QString errorMsg;
-    bool empty = true;
     size_t i = 0;
     for (auto&& arrobj : obj["models"].toArray()) {
         ++i;
-        empty = false;
         QJsonObject obj = arrobj.toObject();
         auto remoteModel = parseModelInfo(obj, Remote, &errorMsg);
         if (!remoteModel) {
@@ -689,16 +955,38 @@ void ModelManager::parseRemoteModels(QJsonObject obj, QString repositoryUrl) {
             continue;
         }
         remoteModel->repositoryUrl = repositoryUrl;
-        if (!remoteModels_.contains(*remoteModel)) { // This costs O(n). Not happy, is there a better way?
-            remoteModels_.append(std::move(*remoteModel));
-        }
+        selectArchive(obj, *remoteModel);
+        parsed.append(std::move(*remoteModel));
     }
-    if (empty) {
+
+    // Keep what the repository listed before if this catalog is of no use,
+    // e.g. because the server answered with an error page.
+    if (parsed.isEmpty()) {
         emit error(tr("No models found in the repository at %1. Please double check that the repository address is correct.").arg(repositoryUrl));
+        return false;
+    }
+
+    // Whatever the repository listed before is replaced by this.
+    remoteModels_.erase(std::remove_if(remoteModels_.begin(), remoteModels_.end(), [&](Model const &model) {
+        return model.repositoryUrl == repositoryUrl;
+    }), remoteModels_.end());
+    remoteLookup_.rebuild(remoteModels_);
+
+    for (auto &&model : parsed) {
+        bool duplicate = false;
+        for (int row : remoteLookup_.rowsWithId(model.id()))
+            duplicate = duplicate || remoteModels_[row] == model;
+
+        if (!duplicate) {
+            remoteLookup_.add(model, remoteModels_.size());
+            remoteModels_.append(std::move(model));
+        }
     }
 
     std::sort(remoteModels_.begin(), remoteModels_.end());
+    remoteLookup_.rebuild(remoteModels_);
     updateAvailableModels();
+    return true;
 }
 
 const QList<Model>& ModelManager::getInstalledModels() const {
@@ -718,9 +1006,9 @@ const QList<Model>& ModelManager::getUpdatedModels() const {
 }
 
 std::optional<Model> ModelManager::getModelForPath(QString path) const {
-    for (Model const &model : getInstalledModels())
-        if (model.path == path)
-            return model;
+    int row = localLookup_.rowWithPath(path);
+    if (row != -1)
+        return localModels_[row];
 
     return std::nullopt;
 }
@@ -734,37 +1022,30 @@ std::optional<Repository> ModelManager::getRepository(const Model &model) const
 }
 
 void ModelManager::updateAvailableModels() {
-    // Reset the newModels.
-    beginRemoveRows(QModelIndex(), localModels_.size(), localModels_.size() + newModels_.size() - 1);
+    // Most rows change one way or another, so tell the views once at the end
+    // instead of row by row.
+    beginResetModel();
+
     newModels_.clear();
-    endRemoveRows();
     updatedModels_.clear();
 
-    for (auto &&model : remoteModels_) {
-        bool installed = false;
-        bool outdated = false;
-        for (int i = 0; i < localModels_.size(); ++i) {
-            if (localModels_[i].isSameModel(model)) {
-                localModels_[i].remoteAPI = model.remoteAPI;
-                localModels_[i].remoteversion = model.remoteversion;
-                installed = true;
-                outdated = localModels_[i].outdated();
-                emit dataChanged(index(i, 0), index(i, columnCount()));
-                break;
-            }
-        }
+    // Every change to the installed models ends up here.
+    updateRoutes();
 
-        if (!installed) {
+    for (auto &&model : remoteModels_) {
+        int row = localLookup_.rowWithId(model.id());
+        if (row == -1) {
             newModels_.append(model);
+            continue;
         }
-        if (outdated) {
+
+        localModels_[row].remoteAPI = model.remoteAPI;
+        localModels_[row].remoteversion = model.remoteversion;
+        if (localModels_[row].outdated())
             updatedModels_.append(model);
-        }
     }
 
-    // We have changed available models, so insert remotes. Insert only once everything is processed
-    beginInsertRows(QModelIndex(), localModels_.size(), localModels_.size() + newModels_.size() - 1);
-    endInsertRows();
+    endResetModel();
 
     emit localModelsChanged();
 }
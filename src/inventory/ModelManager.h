@@ -1,31 +1,52 @@
 #ifndef MODELMANAGER_H
 #define MODELMANAGER_H
 #include <QDir>
+#include <QHash>
 #include <QMap>
+#include <QPair>
+#include <QSet>
 #include <QList>
 #include <QJsonObject>
 #include <QFuture>
 #include <QAbstractTableModel>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <type_traits>
 
 #include "Network.h"
+#include "CatalogCache.h"
 #include "types.h"
 #include "settings/Settings.h"
 
+const std::size_t constexpr kMinSpeedSampleWords = 20; // Translations of fewer words say too little about how fast a model is, see ModelManager::recordSpeed()
+
 namespace translateLocally {
     namespace models {
         enum Location {
             Remote = 0,
             Local = 1
         };
+
+        /**
+         * What ModelManager::getRoute() prefers when there are multiple ways
+         * to translate between two languages.
+         */
+        enum RoutePolicy {
+            Fastest = 0,
+            BestQuality = 1
+        };
     }
 }
 
 // TODO: our inconsistent use of the translateLocally namespace is really an issue.
 using translateLocally::Repository;
 
+class ArchiveExtractor;
+class ModelIndex;
+class ModelRouter;
+class QTemporaryDir;
+
 /**
  * @Brief outside info about a model that it cannot know about itself in a
  * shipped json file like where did we get it from, when did we get it, etc.
@@ -207,10 +228,65 @@ struct ModelPair {
 
 Q_DECLARE_METATYPE(ModelPair)
 
+/**
+ * @Brief models to translate from one language to another with: `model`, and
+ * if that one doesn't go all the way, `pivot` after it.
+ */
+struct ModelRoute {
+    Model model;
+    std::optional<Model> pivot;
+};
+
+/**
+ * @Brief lookup tables for a list of models by id, path and language pair, so
+ * finding a model doesn't mean going through (and computing the id() of)
+ * every one of them. Holds rows of the list, so whenever the list is reordered
+ * or something is removed from it, rebuild() the lookup as well. Where several
+ * models match, rows are given in the order they were added.
+ */
+class ModelLookup {
+public:
+    void clear();
+
+    /**
+     * @brief start over with all of `models`.
+     */
+    void rebuild(QList<Model> const &models);
+
+    /**
+     * @brief adds the model at `row`. Rows have to be added in order.
+     */
+    void add(Model const &model, int row);
+
+    QList<int> rowsWithId(QString const &id) const;
+
+    /**
+     * @brief first row with this id, or -1.
+     */
+    int rowWithId(QString const &id) const;
+
+    /**
+     * @brief row of the (local) model at this path, or -1.
+     */
+    int rowWithPath(QString const &path) const;
+
+    /**
+     * @brief rows of models that translate from `src` (any of its srcTags)
+     * to `trg`.
+     */
+    QList<int> rowsWithLanguagePair(QString const &src, QString const &trg) const;
+
+private:
+    QHash<QString, QList<int>> byId_;
+    QHash<QString, int> byPath_;
+    QHash<QPair<QString, QString>, QList<int>> byLanguagePair_;
+};
+
 class ModelManager : public QAbstractTableModel {
         Q_OBJECT
 public:
     ModelManager(QObject *parent, Settings *settings);
+    ~ModelManager();
 
     /**
      * @Brief get model by its id
@@ -233,14 +309,50 @@ public:
     std::optional<ModelPair> getModelPairForLanguagePair(QString src, QString trg, QString pivot = QString("en")) const;
 
     /**
-     * @Brief extract a model into the directory of models managed by this
-     * program. The optional filename argument is used to make up a folder name
-     * for the model. If none provided, the basename of file is used. On success
-     * the model is added to the local list of models (i.e. getInstalledModel())
-     * and the function will return the filled in model instance. On failure, an
-     * empty Model object is returned (i.e. model.isLocal() returns false).
+     * @Brief cheapest way to translate from src to trg with the installed
+     * models under `policy`, directly or through any pivot language. Comes
+     * from a table that is kept up to date as models are installed and
+     * removed, so it is cheap to call for every request.
+     */
+    std::optional<ModelRoute> getRoute(QString const &src, QString const &trg, translateLocally::models::RoutePolicy policy = translateLocally::models::Fastest) const;
+
+    /**
+     * @Brief tells getRoute() how fast an installed model turns out to be in
+     * practice: it translated `words` in `seconds` of the translation
+     * service's time. Measurements are added up until the model was busy
+     * long enough to go by. The measured speed takes precedence over the
+     * speed its type suggests, and is remembered in Settings::modelSpeeds.
+     */
+    void recordSpeed(Model const &model, std::size_t words, double seconds);
+
+    /**
+     * @Brief extract a model archive into the directory of models managed by
+     * this program. Extraction runs on a worker thread, and any number of
+     * them can run at the same time. Once done, the model is added to the
+     * local list of models (i.e. getInstalledModel()) and modelInstalled()
+     * is emitted, or installFailed() if it didn't work out. Both pass on
+     * extradata. Returns the extractor for its progress() signal and cancel()
+     * slot, or nullptr if the archive can't be opened.
      */
-    std::optional<Model> writeModel(QFile *file, ModelMeta meta = ModelMeta(), QString filename = QString());
+    ArchiveExtractor *importModel(QString path, ModelMeta meta = ModelMeta(), QVariant extradata = QVariant());
+
+    /**
+     * @Brief download a remote model and extract it while it is coming in.
+     * Interrupted downloads are resumed the next time the same model is
+     * downloaded. Errors are reported through `network`'s
+     * error(QString,QVariant) signal, together with extradata. When it is
+     * done, `network` emits streamComplete(QIODevice*,QString,QVariant),
+     * after which installModel() finishes the job.
+     */
+    SegmentedDownload *downloadModel(Network *network, Model const &model, QVariant extradata = QVariant());
+
+    /**
+     * @Brief counterpart of importModel() for a download started with
+     * downloadModel(): moves the extracted model into place once the
+     * extractor is done. Pass it what Network::streamComplete() gave you.
+     * Ends with modelInstalled() or installFailed(), same as importModel().
+     */
+    void installModel(QIODevice *download, ModelMeta meta = ModelMeta(), QString filename = QString(), QVariant extradata = QVariant());
 
     /**
      * @Brief Tries to delete a model from the getInstalledModels() list. Also
@@ -258,7 +370,7 @@ public:
 
     /**
      * @Brief is this model managed by ModelManager (i.e. created with 
-     * writeModel()).
+     * importModel() or installModel()).
      */
     bool isManagedModel(Model const &model) const;
 
@@ -275,9 +387,10 @@ public:
     const QList<Model>& getInstalledModels() const;
 
     /**
-     * @Brief list of remotely available models. Only populated after
-     * fetchRemoteModels is called and the fetchedRemoteModels() signal is
-     * emitted.
+     * @Brief list of remotely available models. Populated from the catalogs
+     * of repositories that were fetched before (see fetchRemoteModels()),
+     * and updated once fetchRemoteModels() is called and the
+     * fetchedRemoteModels() signal is emitted.
      */
     const QList<Model>& getRemoteModels() const;
 
@@ -296,8 +409,7 @@ public:
 
     /**
      * @Brief updates getNewModels() and getUpdatedModels() lists. Emits the
-     * localModelsChanged() signal. Possibly also the dataChanged() signal if
-     * an installed model appears to be outdated.
+     * localModelsChanged() signal, and resets attached views once.
      */
      void updateAvailableModels();
 
@@ -335,17 +447,81 @@ public slots:
      * By default, it fetches models from the official translateLocally repo, but can also fetch
      * models from a 3rd party repository.
      *
+     * Catalogs are cached on disk. Those checked less than catalogMaxAge
+     * minutes ago are used as they are, without going online. Others are
+     * fetched with a conditional request, so an unchanged catalog costs a
+     * 304 Not Modified instead of the whole thing.
+     *
      * @param extradata Optional argument that is indended if we want to pass extra data to the slot
      */
     void fetchRemoteModels(QVariant extradata = QVariant());
+
+    /**
+     * @Brief like fetchRemoteModels(), but asks every repository whether its
+     * catalog changed, however recently it was checked. For when the user
+     * asks for the list of models.
+     */
+    void refreshRemoteModels(QVariant extradata = QVariant());
     
+private slots:
+    /**
+     * @Brief checks in the background whether the cached catalogs that are
+     * past catalogMaxAge are still current, without the signals of
+     * fetchRemoteModels(). Changes show up through localModelsChanged().
+     */
+    void revalidateCatalogs();
+
 private:
     void startupLoad();
-    void scanForModels(QString path);
-    bool extractTarGz(QFile *file, QDir const &destination, QStringList &files);
-    bool extractTarGzInCurrentPath(QFile *file, QStringList &files);
+
+    /**
+     * @Brief adds the models of every repository that has a cached catalog.
+     */
+    void loadCachedCatalogs();
+
+    /**
+     * @Brief whether the catalog of this repository is in use and was checked
+     * less than catalogMaxAge minutes ago.
+     */
+    bool isCatalogFresh(QString const &url) const;
+
+    /**
+     * @Brief fetches the catalogs of the repositories at `urls`, with the
+     * signals described at fetchRemoteModels().
+     */
+    void fetchCatalogs(QStringList const &urls, QVariant extradata);
+
+    /**
+     * @Brief requests the catalog of the repository at `url`, or returns the
+     * request that is already doing so. Once finished, the catalog is in
+     * use and cached, if it was fetched successfully. Errors are left to
+     * whoever is waiting on the reply.
+     */
+    QNetworkReply *fetchCatalog(QString const &url);
+
+    /**
+     * @Brief adds the models and archives in a directory. Uses what is in
+     * the index for whatever didn't change since it was last scanned, and
+     * updates the index with the rest.
+     */
+    void scanForModels(QString path, ModelIndex &index);
+    /**
+     * @Brief takes over an extractor, and installs what it extracted once it
+     * is done.
+     */
+    void installWhenExtracted(ArchiveExtractor *extractor, ModelMeta meta, QString filename, QVariant extradata);
+    /**
+     * @Brief validates the extracted model and moves it out of tempDir, to
+     * where it is managed.
+     */
+    std::optional<Model> installExtractedModel(QTemporaryDir &tempDir, QStringList const &extracted, ModelMeta meta, QString filename);
     std::optional<Model> parseModelInfo(QJsonObject& obj, translateLocally::models::Location type=translateLocally::models::Location::Local, QString *error = nullptr);
-    void parseRemoteModels(QJsonObject obj, QString repositoryUrl);
+    /**
+     * @Brief replaces the models of a repository with those in its catalog.
+     * Returns false, and keeps the models it had, if the catalog has no
+     * usable models.
+     */
+    bool parseRemoteModels(QJsonObject obj, QString repositoryUrl);
     QJsonObject getModelInfoJsonFromDir(QString dir, QString *error = nullptr);
 
     /**
@@ -353,6 +529,17 @@ private:
      */
     bool readModelMetaFromDir(ModelMeta &model, QString dir) const;
 
+    /**
+     * @Brief reads modelMeta.json from an installed model. Empty if there
+     * is none, or if it can't be parsed.
+     */
+    QJsonObject getModelMetaJsonFromDir(QString dir) const;
+
+    /**
+     * @Brief fills in model metadata from the contents of a modelMeta.json.
+     */
+    void applyModelMeta(ModelMeta &model, QJsonObject const &obj) const;
+
     /**
      * @Brief writes a model's metadata to an installed model.
      */
@@ -365,6 +552,13 @@ private:
      */
     bool insertLocalModel(Model model);
 
+    /**
+     * @Brief insertLocalModel() for a whole batch of models at once, e.g.
+     * those found by scanForModels(). Views are reset once at the end instead
+     * of being told about every row.
+     */
+    void insertLocalModels(QList<Model> const &models);
+
     /**
      * @Brief validate a model, currently by trying to parse the model_info.json
      * file with getModelInfoJsonFromDir(QString) and parseModelInfo(QJsonObject).
@@ -373,6 +567,17 @@ private:
      */
     bool validateModel(QString path);
 
+    /**
+     * @Brief rebuilds the table behind getRoute().
+     */
+    void updateRoutes();
+
+    /**
+     * @Brief writes the speeds measured since the last time to the
+     * model_speeds setting.
+     */
+    void saveSpeeds();
+
     QDir appDataDir_;
 
     QStringList archives_; // Only archive name, not full path
@@ -380,6 +585,22 @@ private:
     QList<Model> remoteModels_;
     QList<Model> newModels_;
     QList<Model> updatedModels_;
+    ModelLookup localLookup_; // Rows of localModels_
+    ModelLookup remoteLookup_; // Rows of remoteModels_
+    std::unique_ptr<ModelRouter> router_; // Routes over localModels_
+    QHash<QString, double> speeds_; // Measured words per second, by model id
+
+    // Measurements that don't add up to enough time yet, by model id.
+    struct SpeedSample {
+        std::size_t words{0};
+        double seconds{0};
+    };
+    QHash<QString, SpeedSample> speedSamples_;
+    QSet<QString> unsavedSpeeds_; // Model ids; saveSpeeds() is scheduled if not empty
+
+    CatalogCache catalogs_;
+    QHash<QString, QDateTime> catalogCheckedOn_; // Repositories in remoteModels_, and when their catalog was last checked
+    QHash<QString, QNetworkReply *> catalogReplies_; // Catalogs being fetched
 
     Network *network_;
     Settings *settings_;
@@ -389,6 +610,8 @@ signals:
     void fetchingRemoteModels();
     void fetchedRemoteModels(QVariant extradata =  QVariant()); // when finished fetching (might be error)
     void localModelsChanged();
+    void modelInstalled(Model model, QVariant extradata = QVariant());
+    void installFailed(QString error, QVariant extradata = QVariant());
     void error(QString);
 };
 
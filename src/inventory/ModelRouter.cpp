@@ -0,0 +1,118 @@
+#include "ModelRouter.h"
+#include <cmath>
+
+using translateLocally::models::RoutePolicy;
+
+namespace {
+
+// Words per second a model of each type manages on a typical machine. Only
+// how they compare matters, until a model's actual speed has been measured.
+const double kTinySpeed = 800;
+const double kBaseSpeed = 400;
+const double kOtherSpeed = 500;
+
+// How much quality a model gives up, relative to a base model.
+const double kTinyQualityLoss = 2;
+const double kBaseQualityLoss = 1;
+const double kOtherQualityLoss = 1.5;
+
+// Measured speeds that are this far off what the routes were built with
+// make them worth rebuilding.
+const double kSpeedTolerance = 0.2;
+
+} // Anonymous namespace
+
+double ModelRouter::declaredSpeed(Model const &model) {
+    if (model.type == "tiny")
+        return kTinySpeed;
+    if (model.type == "base")
+        return kBaseSpeed;
+    return kOtherSpeed;
+}
+
+double ModelRouter::speed(Model const &model) const {
+    double measured = speeds_.value(model.id());
+    return measured > 0 ? measured : declaredSpeed(model);
+}
+
+ModelRouter::Cost ModelRouter::cost(Model const &model, RoutePolicy policy) const {
+    double time = 1.0 / speed(model); // Seconds per word
+
+    double loss = kOtherQualityLoss;
+    if (model.type == "tiny")
+        loss = kTinyQualityLoss;
+    else if (model.type == "base")
+        loss = kBaseQualityLoss;
+
+    switch (policy) {
+        case translateLocally::models::BestQuality:
+            return {loss, time};
+        case translateLocally::models::Fastest:
+        default:
+            return {time, loss};
+    }
+}
+
+void ModelRouter::rebuild(QList<Model> const &models, QHash<QString, double> const &speeds) {
+    models_ = models;
+    speeds_ = speeds;
+
+    for (RoutePolicy policy : {translateLocally::models::Fastest, translateLocally::models::BestQuality}) {
+        QHash<QPair<QString, QString>, Hop> &routes = routes_[policy];
+        routes.clear();
+
+        // Cheapest model for every pair of languages. Of equally cheap ones
+        // the first in the list wins.
+        for (int row = 0; row < models_.size(); ++row) {
+            Model const &model = models_[row];
+            Cost modelCost = cost(model, policy);
+            for (auto it = model.srcTags.constBegin(); it != model.srcTags.constEnd(); ++it) {
+                auto key = qMakePair(it.key(), model.trgTag);
+                auto existing = routes.constFind(key);
+                if (existing == routes.constEnd() || modelCost < existing->cost)
+                    routes.insert(key, Hop{row, -1, modelCost});
+            }
+        }
+
+        QHash<QPair<QString, QString>, Hop> const direct = routes;
+
+        // Direct routes out of every language, to extend with.
+        QHash<QString, QList<QPair<QString, Hop>>> outgoing;
+        for (auto it = direct.constBegin(); it != direct.constEnd(); ++it)
+            outgoing[it.key().first].append(qMakePair(it.key().second, it.value()));
+
+        // Through a pivot, where there is no direct route or where that is
+        // cheaper. Combining the cheapest direct routes on either side of the
+        // pivot gives the cheapest route through it.
+        for (auto it = direct.constBegin(); it != direct.constEnd(); ++it) {
+            QString const &src = it.key().first;
+            for (auto &&next : outgoing.value(it.key().second)) {
+                if (next.first == src)
+                    continue;
+
+                Cost pivotCost{it->cost.first + next.second.cost.first, it->cost.second + next.second.cost.second};
+                auto key = qMakePair(src, next.first);
+                auto existing = routes.constFind(key);
+                if (existing == routes.constEnd() || pivotCost < existing->cost)
+                    routes.insert(key, Hop{it->first, next.second.first, pivotCost});
+            }
+        }
+    }
+}
+
+std::optional<ModelRoute> ModelRouter::route(QString const &src, QString const &trg, RoutePolicy policy) const {
+    auto it = routes_[policy].constFind(qMakePair(src, trg));
+    if (it == routes_[policy].constEnd())
+        return std::nullopt;
+
+    ModelRoute route{models_[it->first], std::nullopt};
+    if (it->second != -1)
+        route.pivot = models_[it->second];
+
+    return route;
+}
+
+bool ModelRouter::isOutdated(QString const &id, double wordsPerSecond) const {
+    double used = speeds_.value(id);
+    return used <= 0 || std::abs(wordsPerSecond - used) > kSpeedTolerance * used;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "ModelManager.h"
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <optional>
+#include <utility>
+
+/**
+ * Routes between languages over the installed models, for
+ * ModelManager::getRoute(). Languages are the nodes of a graph, and every
+ * model is an edge from each of its srcTags to its trgTag, weighted by how
+ * long it takes per word and by how much quality it gives up. rebuild()
+ * finds the cheapest route between every pair of languages up front, so
+ * looking one up is a single hash lookup.
+ *
+ * Routes go through at most one pivot language, as bergamot can't chain more
+ * than two models.
+ */
+class ModelRouter {
+public:
+    /**
+     * @brief routes over `models`. Measured words per second in `speeds`
+     * (by model id) take precedence over declaredSpeed().
+     */
+    void rebuild(QList<Model> const &models, QHash<QString, double> const &speeds);
+
+    std::optional<ModelRoute> route(QString const &src, QString const &trg, translateLocally::models::RoutePolicy policy) const;
+
+    /**
+     * @brief whether the routes were built with a speed for this model that
+     * is far enough off `wordsPerSecond` that they should be rebuilt.
+     */
+    bool isOutdated(QString const &id, double wordsPerSecond) const;
+
+    /**
+     * @brief words per second to expect of a model that hasn't been measured
+     * yet, going by its type.
+     */
+    static double declaredSpeed(Model const &model);
+
+private:
+    // Cost of a route under a policy: what the policy minimises first, and
+    // what breaks ties. Costs of models add up along a route.
+    typedef std::pair<double, double> Cost;
+
+    struct Hop {
+        int first; // Row in models_
+        int second; // Row of the pivot model, or -1 for a direct route
+        Cost cost;
+    };
+
+    Cost cost(Model const &model, translateLocally::models::RoutePolicy policy) const;
+    double speed(Model const &model) const;
+
+    QList<Model> models_;
+    QHash<QString, double> speeds_;
+    QHash<QPair<QString, QString>, Hop> routes_[2]; // By RoutePolicy
+};
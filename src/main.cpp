@@ -8,7 +8,9 @@
 #include <QTimer>
 #include "cli/CLIParsing.h"
 #include "cli/CommandLineIface.h"
+#include "cli/HttpServer.h"
 #include "cli/NativeMsgIface.h"
+#include "cli/NativeMsgRelay.h"
 #include "types.h"
 
 int main(int argc, char *argv[])
@@ -46,10 +48,52 @@ int main(int argc, char *argv[])
                 return CommandLineIface().run(parser);
             case translateLocally::AppType::NativeMsg:
         {
+                // If another browser's host is running already, relay to it
+                // instead of loading the same models again. Otherwise we're
+                // the host the others relay to.
+                bool shared = Settings().sharedNativeHost();
+                auto startRelay = [&]() {
+                    NativeMsgRelay *relay = NativeMsgRelay::connectTo(NativeMsgRelay::hostName(), &translateLocally);
+                    if (!relay)
+                        return false;
+                    QObject::connect(relay, &NativeMsgRelay::finished, &translateLocally, &QCoreApplication::quit);
+                    QTimer::singleShot(0, relay, &NativeMsgRelay::run);
+                    return true;
+                };
+
+                if (shared && startRelay())
+                    return translateLocally.exec();
+
                 NativeMsgIface * nativeMSG = new NativeMsgIface(&translateLocally);
+
+                // If another browser's host started at the same moment and
+                // got to listen first, relay to that one after all. Should
+                // that fail too, we serve just our own browser.
+                if (shared && !nativeMSG->listen(NativeMsgRelay::hostName()) && startRelay()) {
+                    delete nativeMSG;
+                    return translateLocally.exec();
+                }
                 QObject::connect(nativeMSG, &NativeMsgIface::finished, &translateLocally, &QCoreApplication::quit);
                 QTimer::singleShot(0, nativeMSG, &NativeMsgIface::run);
                 return translateLocally.exec();
+        }
+            case translateLocally::AppType::Serve:
+        {
+                bool ok;
+                quint16 port = parser.value("serve").toUShort(&ok);
+                if (!ok) {
+                    qCritical() << "Invalid port:" << parser.value("serve");
+                    return 1;
+                }
+
+                // Same engine as for native messaging, just without stdin.
+                NativeMsgIface * host = new NativeMsgIface(&translateLocally);
+                HttpServer * server = new HttpServer(host, &translateLocally);
+                if (!server->listen(port)) {
+                    qCritical() << "Could not listen on port" << port << ":" << server->errorString();
+                    return 1;
+                }
+                return translateLocally.exec();
         }
             case translateLocally::AppType::GUI:
                 break; //Handled later outside this scope.
@@ -4,6 +4,7 @@
 #include <memory>
 #include <functional>
 #include "MarianInterface.h"
+#include "SharedHostInterface.h"
 
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
@@ -21,6 +22,7 @@
 #include <QWindow>
 #include "Translation.h"
 #include "cli/NativeMsgManager.h"
+#include "cli/NativeMsgRelay.h"
 #include "logo/logo_svg.h"
 #include <iostream>
 #include <QScrollBar>
@@ -110,15 +112,14 @@ MainWindow::MainWindow(QWidget *parent)
     // Network is only used for downloading models
     connect(&network_, &Network::error, this, &MainWindow::popupError); // All errors from the network class will be propagated to the GUI
     connect(&network_, &Network::progressBar, this, &MainWindow::downloadProgress);
-    connect(&network_, &Network::downloadComplete, this, &MainWindow::handleDownload);
+    connect(&network_, &Network::streamComplete, this, &MainWindow::handleDownload);
+    connect(&models_, &ModelManager::modelInstalled, this, &MainWindow::handleInstalled);
 
     // Make downloading from the settings window.
     connect(&translatorSettingsDialog_, &TranslatorSettingsDialog::downloadModel, this, &MainWindow::downloadModelHelperSlot);
     
     // Set up the connection to the translator
-    connect(translator_, &MarianInterface::pendingChanged, ui_->pendingIndicator, &QProgressBar::setVisible);
-    connect(translator_, &MarianInterface::error, this, &MainWindow::popupError);
-    connect(translator_, &MarianInterface::translationReady, this, [&](Translation translation) {
+    auto showTranslation = [&](Translation translation) {
         translation_ = translation;
         
         {   
@@ -147,7 +148,32 @@ MainWindow::MainWindow(QWidget *parent)
         } else {
             ui_->statusbar->clearMessage();
         }
-    });
+    };
+
+    connect(translator_, &MarianInterface::pendingChanged, ui_->pendingIndicator, &QProgressBar::setVisible);
+    connect(translator_, &MarianInterface::error, this, &MainWindow::popupError);
+    connect(translator_, &MarianInterface::translationReady, this, showTranslation);
+
+    // With the shared_native_host setting, translate through the native
+    // messaging host of a browser if one is running, instead of loading the
+    // same models in this process too.
+    if (settings_.sharedNativeHost())
+        host_ = SharedHostInterface::connectTo(NativeMsgRelay::hostName(), this);
+
+    if (host_) {
+        connect(host_, &SharedHostInterface::pendingChanged, ui_->pendingIndicator, &QProgressBar::setVisible);
+        connect(host_, &SharedHostInterface::error, this, &MainWindow::popupError);
+        connect(host_, &SharedHostInterface::translationReady, this, showTranslation);
+
+        // Once the browser closes its host, load the model here after all.
+        connect(host_, &SharedHostInterface::disconnected, this, [&]() {
+            host_->deleteLater();
+            host_.clear();
+            ui_->translateAction->setEnabled(true);
+            ui_->translateButton->setEnabled(true);
+            resetTranslator();
+        });
+    }
 
     connect(alignmentWorker_, &AlignmentWorker::ready, this, [&](QVector<WordAlignment> alignments, Translation::Direction direction) {
         if (!highlighter_)
@@ -194,6 +220,19 @@ MainWindow::MainWindow(QWidget *parent)
         }
     });
 
+    // Alignments are computed by the model, so switching highlighting on means
+    // reloading it. If there is a translation on screen, translate it again to
+    // fetch its alignments. Switching it off doesn't reload: the model just
+    // keeps computing alignments until it is reloaded for another reason.
+    connect(&settings_.showAlignment, &Setting::valueChanged, this, [&]() {
+        if (!settings_.showAlignment())
+            return;
+
+        resetTranslator();
+        if (!settings_.translateImmediately() && translation_)
+            translate();
+    });
+
     // Connect changing the highlight colour in settings to updating the highlighter to use it.
     connect(&settings_.alignmentColor, &Setting::valueChanged, this, [&](QString name, QVariant color) {
         if (highlighter_)
@@ -271,7 +310,7 @@ Would you like to connect to the Internet to see a list of available translation
                                QMessageBox::Ok | QMessageBox::Cancel, this);
         int ret = firstRun.exec();
         if (ret == QMessageBox::Ok) {
-            models_.fetchRemoteModels();
+            models_.refreshRemoteModels();
         }
     }
 }
@@ -304,13 +343,16 @@ void MainWindow::showDownloadPane(bool visible)
     ui_->modelPane->setVisible(!visible);
 }
 
-void MainWindow::handleDownload(QFile *file, QString filename, QVariant extra) {
+void MainWindow::handleDownload(QIODevice *download, QString filename, QVariant extra) {
     ModelMeta meta = extra.value<ModelMeta>();
     meta.installedOn = QDateTime::currentDateTimeUtc();
-    auto model = models_.writeModel(file, meta, filename);
-    if (model) { // if writeModel didn't fail
-        settings_.translationModel.setValue(model->path, Setting::AlwaysEmit);
-    }
+    models_.installModel(download, meta, filename, extra);
+}
+
+void MainWindow::handleInstalled(Model model, QVariant extra) {
+    // Switch to models downloaded from here, but not to imported ones.
+    if (extra.canConvert<ModelMeta>())
+        settings_.translationModel.setValue(model.path, Setting::AlwaysEmit);
 }
 
 void MainWindow::downloadProgress(qint64 ist, qint64 max) {
@@ -331,16 +373,16 @@ void MainWindow::downloadModel(Model model) {
 
     qDebug() << "Downloading:" << model;
 
-    QNetworkReply *reply = network_.downloadFile(model.url, QCryptographicHash::Sha256, model.checksum, QVariant::fromValue(meta));
-    // If downloadFile could not create a temporary file, abort. network_ will
+    SegmentedDownload *download = models_.downloadModel(&network_, model, QVariant::fromValue(meta));
+    // If downloadModel could not create a temporary dir, abort. network_ will
     // have emitted an error(QString) already so no need to notify.
-    if (reply == nullptr) {
+    if (download == nullptr) {
         showDownloadPane(false);
         return;
     }
     
-    connect(ui_->cancelDownloadButton, &QPushButton::clicked, reply, &QNetworkReply::abort);
-    connect(reply, &QNetworkReply::finished, this, [&]() {
+    connect(ui_->cancelDownloadButton, &QPushButton::clicked, download, &SegmentedDownload::abort);
+    connect(download, &SegmentedDownload::finished, this, [&]() {
         showDownloadPane(false);
     });
 }
@@ -362,7 +404,7 @@ void MainWindow::on_localModels_activated(int index) {
     } else if (data.canConvert<Model>()) {
         downloadModel(data.value<Model>());
     } else if (data == Action::FetchRemoteModels) {
-        models_.fetchRemoteModels();
+        models_.refreshRemoteModels();
     } else {
         qDebug() << "Unknown option: " << data;
     }
@@ -448,7 +490,7 @@ void MainWindow::translate() {
 void MainWindow::translate(QString const &text) {
     ui_->translateAction->setEnabled(false); //Disable the translate button before the translation finishes
     ui_->translateButton->setEnabled(false);
-    if (translator_->model().isEmpty()) {
+    if ((host_ ? host_->model() : translator_->model()).isEmpty()) {
         if (models_.getInstalledModels().isEmpty()) {
             showFirstRunHelper();
         } else { // TBH I am not sure how we can ever end up in the else branch but better to have it.
@@ -456,13 +498,22 @@ void MainWindow::translate(QString const &text) {
             ui_->localModels->showPopup(); // Makes it a bit more intuitive for the user to know what to do
         }
     } else {
-        translator_->translate(text);
+        // The widget boundary: this is the only UTF-16 to UTF-8 conversion on
+        // the way into the translator.
+        if (host_)
+            host_->translate(Utf8String::fromQString(text));
+        else
+            translator_->translate(Utf8String::fromQString(text));
     }    
 }
 
 void MainWindow::resetTranslator() {
     // Note: settings_.translationModel() can be empty string, meaning unload the current model
-    translator_->setModel(settings_.translationModel(), settings_.marianSettings());
+    // Alignments are only computed while they are shown.
+    if (host_)
+        host_->setModel(models_.getModelForPath(settings_.translationModel()).value_or(Model()), settings_.showAlignment());
+    else
+        translator_->setModel(settings_.translationModel(), settings_.marianSettings(), settings_.showAlignment());
     
     // Schedule re-translation immediately if we're in automatic mode.
     if (!settings_.translationModel().isEmpty() && settings_.translateImmediately())
@@ -11,6 +11,7 @@
 #include "settings/Settings.h"
 
 class MarianInterface;
+class SharedHostInterface;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -25,7 +26,8 @@ public:
     ~MainWindow();
     // Network temporaries until I figure out a better way
     void onResult(QJsonObject obj);
-    void handleDownload(QFile *file, QString filename, QVariant extra);
+    void handleDownload(QIODevice *download, QString filename, QVariant extra);
+    void handleInstalled(Model model, QVariant extra);
     void downloadProgress(qint64 ist, qint64 max);
     void updateModelSettings(size_t memory, size_t cores);
 
@@ -93,6 +95,7 @@ private:
 
     // Translator related settings
     QPointer<MarianInterface> translator_;
+    QPointer<SharedHostInterface> host_; // Used instead of translator_ while connected, see SharedHostInterface
     Translation translation_;
 
     void resetTranslator();
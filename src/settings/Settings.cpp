@@ -19,11 +19,19 @@ Settings::Settings(QObject *parent)
 , syncScrolling(backing_, "sync_scrolling", true)
 , windowGeometry(backing_, "window_geometry")
 , cacheTranslations(backing_, "cache_translations", true)
+, modelCacheMemory(backing_, "model_cache_memory", 1024)
+, modelLoadThreads(backing_, "model_load_threads", 1)
+, statsFile(backing_, "stats_file", "")
+, inputQueueMemory(backing_, "input_queue_memory", 256)
+, maxQueuedWords(backing_, "max_queued_words", 1000000)
+, sharedNativeHost(backing_, "shared_native_host", false)
 , repos(backing_, "newrepos", QMap<QString, translateLocally::Repository>{{translateLocally::kDefaultRepositoryURL, translateLocally::Repository{
                                                                                  translateLocally::kDefaultRepositoryName,
                                                                                  translateLocally::kDefaultRepositoryURL,
                                                                                  true
                                                                              }}})
+, catalogMaxAge(backing_, "catalog_max_age", 24 * 60)
+, modelSpeeds(backing_, "model_speeds")
 , nativeMessagingClients(backing_, "native_messaging_clients", {
     // Firefox browser extension: https://github.com/jelmervdl/firefox-translations (unlisted & public)
     "{c9cdf885-0431-4eed-8e18-967b1758c951}",
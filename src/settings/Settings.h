@@ -106,6 +106,14 @@ public:
     SettingImpl<bool> syncScrolling;
     SettingImpl<QByteArray> windowGeometry;
     SettingImpl<bool> cacheTranslations;
+    SettingImpl<unsigned int> modelCacheMemory; // MB of models the native messaging host keeps loaded
+    SettingImpl<unsigned int> modelLoadThreads; // Models the native messaging host loads at the same time
+    SettingImpl<QString> statsFile; // If set, the native messaging host periodically writes its Stats here
+    SettingImpl<unsigned int> inputQueueMemory; // MB of native messaging input that may wait to be answered before the host stops reading
+    SettingImpl<unsigned int> maxQueuedWords; // Words that may wait for the translation service before new translations are turned away
+    SettingImpl<bool> sharedNativeHost; // Native messaging hosts of all browsers and the GUI share the models of the first host, see NativeMsgRelay and SharedHostInterface
     SettingImpl<QMap<QString, translateLocally::Repository>> repos;
+    SettingImpl<unsigned int> catalogMaxAge; // Minutes a downloaded repository catalog is used before asking the repository whether it changed
+    SettingImpl<QVariantMap> modelSpeeds; // Measured words per second by model id, see ModelManager::recordSpeed()
     SettingImpl<QSet<QString>> nativeMessagingClients;
 };
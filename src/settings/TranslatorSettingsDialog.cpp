@@ -149,12 +149,11 @@ void TranslatorSettingsDialog::importModels() {
     QStringList paths = QFileDialog::getOpenFileNames(this,
         tr("Open Translation model"),
         QString(),
-        tr("Packaged translation model (*.tar.gz)"));
+        tr("Packaged translation model (*.tar.gz *.tgz *.tar.zst *.tar.xz *.txz)"));
 
-    for (QString const &path : paths) {
-        QFile file(path);
-        modelManager_->writeModel(&file);
-    }
+    // These extract side by side, in the background.
+    for (QString const &path : paths)
+        modelManager_->importModel(path);
 }
 
 void TranslatorSettingsDialog::showEvent(QShowEvent *ev)
@@ -259,6 +258,6 @@ void TranslatorSettingsDialog::on_downloadButton_clicked()
 
 void TranslatorSettingsDialog::on_getMoreButton_clicked()
 {
-    modelManager_->fetchRemoteModels();
+    modelManager_->refreshRemoteModels();
     ui_->getMoreButton->setEnabled(false);
 }